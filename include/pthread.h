@@ -64,24 +64,53 @@ extern "C" {
 #define USE_SPINLOCK_EPERM					1
 /* Set this to 0 to disable it */
 #define USE_MUTEX_CriticalSection_SpinCount	0
+/* Spin count of PTHREAD_MUTEX_ADAPTIVE_NP mutexes on critical sections */
+#define USE_MUTEX_CriticalSection_AdaptiveSpinCount	4000
+/* Upper bound of the learned spin budget of PTHREAD_MUTEX_ADAPTIVE_NP */
+#define USE_MUTEX_AdaptiveSpinMax			100
+/* Spins of a PTHREAD_MUTEX_POLICY_FIFO_NP waiter before it blocks */
+#define USE_MUTEX_FifoSpinCount				100
+/* Spins of a condition variable waiter before it blocks */
+#define USE_COND_SpinCount				100
+/* Spins of a pthread_rwlock waiter before it blocks */
+#define USE_RWLOCK_SpinCount				100
+/* Pauses of a spinlock waiter per thread queued ahead of it */
+#define USE_SPINLOCK_BackoffStep			32
+/* Spinlock waiters queued further back yield their time slice */
+#define USE_SPINLOCK_YieldQueue				8
+/* ... as do waiters whose queue didn't move for this many looks */
+#define USE_SPINLOCK_YieldStalls			64
+/* Spinlock waiters spin a calibrated while, yield, and on internal locks sleep */
+#define USE_SPINLOCK_Hybrid				1
+/* Microseconds a USE_SPINLOCK_Hybrid waiter spins before it yields */
+#define USE_SPINLOCK_HybridSpinUs			20
+/* Yields of a USE_SPINLOCK_Hybrid waiter before it sleeps */
+#define USE_SPINLOCK_HybridYields			16
 
 /* A few ways to implement pthread_mutex:  */
 //#define USE_MUTEX_Mutex 1
 /* Faster than Mutex but NOT cross-process.  */
 #define USE_MUTEX_CriticalSection 1
+/* Keep the mutex state inside pthread_mutex_t instead of allocating it,
+   changes the ABI of pthread_mutex_t.  Implies USE_MUTEX_Mutex.  */
+//#define USE_MUTEX_InPlace 1
 
 /* A few ways to implement pthread_cond:  */
-/* default.  */
-#define USE_COND_Semaphore 1
+/* default, waiters queue up and get requeued onto the mutex.  */
+#define USE_COND_Queue 1
 /* USE_COND_SignalObjectAndWait has a flaw at timeout, hopefully fixed.  */
 //#define USE_COND_SignalObjectAndWait 1
-/* USE_COND_ConditionVariable is Windows Vista+, NOT cross-process.  */
+/* USE_COND_ConditionVariable is Windows Vista+ (_WIN32_WINNT 0x0600),
+   process-shared ones still use the default.  */
 //#define USE_COND_ConditionVariable 1
 
 /* A few ways to implement pthread_rwlock:  */
-/* default, use pthread_cond above.  */
-#define USE_RWLOCK_pthread_cond 1
-/* USE_RWLOCK_SRWLock is Windows Vista+, NOT cross-process.  */
+/* default, a single atomic state word and a queue for waiters.  */
+#define USE_RWLOCK_Atomic 1
+/* use pthread_mutex and pthread_cond above.  */
+//#define USE_RWLOCK_pthread_cond 1
+/* USE_RWLOCK_SRWLock is Windows 7+ (_WIN32_WINNT 0x0601), process-shared
+   ones still use the default.  */
 //#define USE_RWLOCK_SRWLock 1
 
 /* Experimental, use a synchronization object for timed waits:  */
@@ -100,9 +129,21 @@ extern "C" {
 #endif
 
 #ifdef USE_COND_ConditionVariable
+#undef USE_COND_Queue
+#endif
+
+#ifdef USE_RWLOCK_SRWLock
+#undef USE_RWLOCK_pthread_cond
+#endif
+
+#if defined USE_RWLOCK_SRWLock || defined USE_RWLOCK_pthread_cond
+#undef USE_RWLOCK_Atomic
+#endif
+
+#ifdef USE_MUTEX_InPlace
 #undef USE_MUTEX_CriticalSection
 #undef USE_MUTEX_Mutex
-#define USE_MUTEX_CriticalSection	1
+#define USE_MUTEX_Mutex	1
 #endif
 
 /* Error-codes.  */
@@ -147,16 +188,28 @@ extern "C" {
 #define PTHREAD_PRIO_NONE 0
 #define PTHREAD_PRIO_INHERIT 8
 #define PTHREAD_PRIO_PROTECT 16
-#define PTHREAD_PRIO_MULT 32
+#define PTHREAD_PRIO_MULT 64
+/* An object initialized PTHREAD_PROCESS_SHARED holds just a key.  Its
+   state is in a named file mapping, and its waiters block on a named
+   semaphore.  A process opens both at its first use of the object and
+   keeps them, a mapping view and two handles, until it destroys the
+   object or exits.  They vanish once no process has them open, for
+   instance when the process which initialized the object exits before
+   any other used it.  Later uses then fail with EINVAL, as do uses of a
+   destroyed object.  */
 #define PTHREAD_PROCESS_SHARED 0
 #define PTHREAD_PROCESS_PRIVATE 1
 
 #define PTHREAD_MUTEX_FAST_NP		PTHREAD_MUTEX_NORMAL
 #define PTHREAD_MUTEX_TIMED_NP		PTHREAD_MUTEX_FAST_NP
-#define PTHREAD_MUTEX_ADAPTIVE_NP	PTHREAD_MUTEX_FAST_NP
+#define PTHREAD_MUTEX_ADAPTIVE_NP	3
 #define PTHREAD_MUTEX_ERRORCHECK_NP	PTHREAD_MUTEX_ERRORCHECK
 #define PTHREAD_MUTEX_RECURSIVE_NP	PTHREAD_MUTEX_RECURSIVE
 
+/* Queueing policy, see pthread_mutexattr_setpolicy_np.  */
+#define PTHREAD_MUTEX_POLICY_DEFAULT_NP	0	/* unfair, waiters may be overtaken */
+#define PTHREAD_MUTEX_POLICY_FIFO_NP	1	/* handed over in arrival order */
+
 void * pthread_timechange_handler_np(void * dummy);
 int pthread_delay_np (const struct timespec *interval);
 int pthread_num_processors_np(void);
@@ -171,10 +224,6 @@ int pthread_set_num_processors_np(int n);
 #define pthread_atfork(F1,F2,F3) 0
 
 /* unsupported stuff: */
-#define pthread_condattr_getclock(A, C) ENOTSUP
-#define pthread_condattr_setclock(A, C) ENOTSUP
-#define pthread_mutex_getprioceiling(M, P) ENOTSUP
-#define pthread_mutex_setprioceiling(M, P) ENOTSUP
 #define pthread_getcpuclockid(T, C) ENOTSUP
 #define pthread_attr_getguardsize(A, S) ENOTSUP
 #define pthread_attr_setgaurdsize(A, S) ENOTSUP
@@ -226,6 +275,16 @@ struct itimerspec {
 };
 #endif
 
+#ifndef CLOCK_REALTIME
+typedef int clockid_t;
+
+#define CLOCK_REALTIME	0	/* wall clock, may be set */
+#define CLOCK_MONOTONIC	1	/* performance counter, never set */
+#endif
+
+int clock_gettime(clockid_t clock_id, struct timespec *tp);
+int clock_getres(clockid_t clock_id, struct timespec *res);
+
 /* Some POSIX realtime extensions, mostly stubbed */
 #define SCHED_OTHER     0
 #define SCHED_FIFO      1
@@ -259,7 +318,17 @@ int pthread_setschedparam(pthread_t thread, int pol, const struct sched_param *p
 
 /* synchronization objects */
 typedef void	*pthread_spinlock_t;
+#ifdef USE_MUTEX_InPlace
+/* Storage of the mutex, the private part is mutex_t of src/mutex.h.  */
+typedef struct pthread_mutex_t pthread_mutex_t;
+struct pthread_mutex_t {
+    long __valid;
+    int __type;
+    void *__priv[14];
+};
+#else
 typedef void	*pthread_mutex_t;
+#endif
 typedef void	*pthread_cond_t;
 typedef void	*pthread_rwlock_t;
 typedef void	*pthread_barrier_t;
@@ -272,10 +341,19 @@ typedef void	*pthread_barrier_t;
 #define GENERIC_ERRORCHECK_INITIALIZER			UINT2PTR(-2)
 #define GENERIC_RECURSIVE_INITIALIZER			UINT2PTR(-3)
 #define GENERIC_NORMAL_INITIALIZER			UINT2PTR(-1)
+#ifdef USE_MUTEX_InPlace
+/* Statically initialized mutexes are ready to use: valid and unlocked.  */
+#define GENERIC_MUTEX_INPLACE_INITIALIZER(type)		{ 0xBAB1F00D, (type), { 0 } }
+#define PTHREAD_MUTEX_INITIALIZER			GENERIC_MUTEX_INPLACE_INITIALIZER(PTHREAD_MUTEX_DEFAULT)
+#define PTHREAD_RECURSIVE_MUTEX_INITIALIZER		GENERIC_MUTEX_INPLACE_INITIALIZER(PTHREAD_MUTEX_RECURSIVE)
+#define PTHREAD_ERRORCHECK_MUTEX_INITIALIZER		GENERIC_MUTEX_INPLACE_INITIALIZER(PTHREAD_MUTEX_ERRORCHECK)
+#define PTHREAD_NORMAL_MUTEX_INITIALIZER		GENERIC_MUTEX_INPLACE_INITIALIZER(PTHREAD_MUTEX_NORMAL)
+#else
 #define PTHREAD_MUTEX_INITIALIZER			(pthread_mutex_t *)GENERIC_INITIALIZER
 #define PTHREAD_RECURSIVE_MUTEX_INITIALIZER		(pthread_mutex_t *)GENERIC_RECURSIVE_INITIALIZER
 #define PTHREAD_ERRORCHECK_MUTEX_INITIALIZER		(pthread_mutex_t *)GENERIC_ERRORCHECK_INITIALIZER
 #define PTHREAD_NORMAL_MUTEX_INITIALIZER		(pthread_mutex_t *)GENERIC_NORMAL_INITIALIZER
+#endif
 #define PTHREAD_DEFAULT_MUTEX_INITIALIZER		PTHREAD_NORMAL_MUTEX_INITIALIZER
 #define PTHREAD_COND_INITIALIZER			(pthread_cond_t *)GENERIC_INITIALIZER
 #define PTHREAD_RWLOCK_INITIALIZER			(pthread_rwlock_t *)GENERIC_INITIALIZER
@@ -319,6 +397,8 @@ int pthread_rwlock_unlock(pthread_rwlock_t *l);
 int pthread_rwlock_tryrdlock(pthread_rwlock_t *l);
 int pthread_rwlock_trywrlock(pthread_rwlock_t *l);
 int pthread_rwlock_destroy (pthread_rwlock_t *l);
+int pthread_rwlock_reltimedrdlock_np(pthread_rwlock_t *l, const struct timespec *rel);
+int pthread_rwlock_reltimedwrlock_np(pthread_rwlock_t *l, const struct timespec *rel);
 
 int pthread_cond_init(pthread_cond_t *cv, const pthread_condattr_t *a);
 int pthread_cond_destroy(pthread_cond_t *cv);
@@ -326,13 +406,34 @@ int pthread_cond_signal (pthread_cond_t *cv);
 int pthread_cond_broadcast (pthread_cond_t *cv);
 int pthread_cond_wait (pthread_cond_t *cv, pthread_mutex_t *external_mutex);
 int pthread_cond_timedwait(pthread_cond_t *cv, pthread_mutex_t *external_mutex, const struct timespec *t);
+int pthread_cond_reltimedwait_np(pthread_cond_t *cv, pthread_mutex_t *external_mutex, const struct timespec *rel);
+int pthread_cond_wait_any_np(pthread_cond_t **cv, int n, pthread_mutex_t *m, const struct timespec *abstime, int *which);
 
 int pthread_mutex_lock(pthread_mutex_t *m);
 int pthread_mutex_timedlock(pthread_mutex_t *m, const struct timespec *ts);
+int pthread_mutex_reltimedlock_np(pthread_mutex_t *m, const struct timespec *rel);
 int pthread_mutex_unlock(pthread_mutex_t *m);
 int pthread_mutex_trylock(pthread_mutex_t *m);
 int pthread_mutex_init(pthread_mutex_t *m, const pthread_mutexattr_t *a);
 int pthread_mutex_destroy(pthread_mutex_t *m);
+int pthread_mutex_getrecursion_np(pthread_mutex_t *m, int *depth);
+int pthread_mutex_lock_multiple_np(pthread_mutex_t **mv, int n);
+int pthread_mutex_timedlock_multiple_np(pthread_mutex_t **mv, int n, const struct timespec *ts);
+
+/* Contention statistics of a mutex, times are in nanoseconds.  */
+typedef struct pthread_mutex_stats_np pthread_mutex_stats_np;
+struct pthread_mutex_stats_np {
+    unsigned long long acquisitions;
+    unsigned long long contended;	/* acquisitions which had to wait */
+    unsigned long long wait_time;
+    unsigned long long wait_time_max;
+    unsigned long long hold_time;
+    long waiters;			/* threads waiting right now */
+};
+
+int pthread_mutex_setstats_np(int enable);
+int pthread_mutex_getstats_np(pthread_mutex_t *m, pthread_mutex_stats_np *s);
+int pthread_mutex_enumstats_np(int (*func)(pthread_mutex_t *m, const pthread_mutex_stats_np *s, void *arg), void *arg);
 
 int pthread_barrier_destroy(pthread_barrier_t *b);
 int pthread_barrier_init(pthread_barrier_t *b, const void *attr, unsigned int count);
@@ -340,11 +441,26 @@ int pthread_barrier_wait(pthread_barrier_t *b);
 
 int pthread_spin_init(pthread_spinlock_t *l, int pshared);
 int pthread_spin_destroy(pthread_spinlock_t *l);
-/* No-fair spinlock due to lack of knowledge of thread number.  */
+/* Spinlocks are fair, waiters get the lock in arrival order.  */
 int pthread_spin_lock(pthread_spinlock_t *l);
 int pthread_spin_trylock(pthread_spinlock_t *l);
+int pthread_spin_timedlock_np(pthread_spinlock_t *l, const struct timespec *ts);
 int pthread_spin_unlock(pthread_spinlock_t *l);
 
+/* Contention statistics of a spinlock.  */
+typedef struct pthread_spin_stats_np pthread_spin_stats_np;
+struct pthread_spin_stats_np {
+    unsigned long long acquisitions;
+    unsigned long long contended;	/* acquisitions which had to spin */
+    unsigned long long spins;		/* looks at the lock while waiting */
+    unsigned long long spins_max;	/* most looks of one acquisition */
+};
+
+int pthread_spin_setstats_np(int enable);
+int pthread_spin_getstats_np(pthread_spinlock_t *l, pthread_spin_stats_np *s);
+/* Also reports the library's internal spinlocks, with l NULL.  */
+int pthread_spin_enumstats_np(int (*func)(pthread_spinlock_t *l, const char *name, const pthread_spin_stats_np *s, void *arg), void *arg);
+
 int pthread_attr_init(pthread_attr_t *attr);
 int pthread_attr_destroy(pthread_attr_t *attr);
 int pthread_attr_setdetachstate(pthread_attr_t *a, int flag);
@@ -368,11 +484,17 @@ int pthread_mutexattr_getprotocol(const pthread_mutexattr_t *a, int *type);
 int pthread_mutexattr_setprotocol(pthread_mutexattr_t *a, int type);
 int pthread_mutexattr_getprioceiling(const pthread_mutexattr_t *a, int * prio);
 int pthread_mutexattr_setprioceiling(pthread_mutexattr_t *a, int prio);
+int pthread_mutex_getprioceiling(const pthread_mutex_t *m, int *prio);
+int pthread_mutex_setprioceiling(pthread_mutex_t *m, int prio, int *old);
+int pthread_mutexattr_getpolicy_np(const pthread_mutexattr_t *a, int *policy);
+int pthread_mutexattr_setpolicy_np(pthread_mutexattr_t *a, int policy);
 
 int pthread_condattr_destroy(pthread_condattr_t *a);
 int pthread_condattr_init(pthread_condattr_t *a);
 int pthread_condattr_getpshared(const pthread_condattr_t *a, int *s);
 int pthread_condattr_setpshared(pthread_condattr_t *a, int s);
+int pthread_condattr_getclock(const pthread_condattr_t *a, clockid_t *clock_id);
+int pthread_condattr_setclock(pthread_condattr_t *a, clockid_t clock_id);
 
 int pthread_barrierattr_init(void **attr);
 int pthread_barrierattr_destroy(void **attr);
@@ -419,6 +541,7 @@ int pthread_barrierattr_getpshared(void **attr, int *s);
 #define recvmsg(...) (pthread_testcancel(), recvmsg(__VA_ARGS__))
 #define select(...) (pthread_testcancel(), select(__VA_ARGS__))
 #define sem_timedwait(...) (pthread_testcancel(), sem_timedwait(__VA_ARGS__))
+#define sem_reltimedwait_np(...) (pthread_testcancel(), sem_reltimedwait_np(__VA_ARGS__))
 #define sem_wait(...) (pthread_testcancel(), sem_wait(__VA_ARGS__))
 #define send(...) (pthread_testcancel(), send(__VA_ARGS__))
 #define sendmsg(...) (pthread_testcancel(), sendmsg(__VA_ARGS__))
@@ -624,4 +747,11 @@ int pthread_barrierattr_getpshared(void **attr, int *s);
 }
 #endif
 
+/* Define WINPTHREAD_INLINE before including this header to get inline
+   fast paths of pthread_spin_lock, pthread_mutex_trylock,
+   pthread_getspecific and some of their relatives.  */
+#ifdef WINPTHREAD_INLINE
+#include "pthread_inline.h"
+#endif
+
 #endif /* WIN_PTHREADS */
@@ -0,0 +1,188 @@
+/* Inline fast paths, included by pthread.h if WINPTHREAD_INLINE is
+   defined.  They handle the uncontended case of initialized objects and
+   call the library for everything else.  They know the heads of some
+   private structures, so use them only with the library version they
+   came with.  */
+#ifndef WIN_PTHREADS_INLINE_H
+#define WIN_PTHREADS_INLINE_H
+
+#include <windows.h>
+
+/* The head of spin_t of src/spinlock.h.  */
+struct _pthread_spin_head {
+    DWORD __owner;
+    unsigned int __valid;
+    LONG __l;
+    volatile LONG __next;
+    volatile LONG __serving;
+};
+
+/* The head of mutex_t of src/mutex.h.  __state and __owner are only
+   there if __fast is set.  */
+struct _pthread_mutex_head {
+    LONG __valid;
+    int __type;
+    LONG __count;
+    short __fast;
+    short __policy;
+    volatile LONG __state;
+    DWORD __owner;
+};
+
+/* The head of _pthread_v of src/thread.h.  */
+struct _pthread_key_head {
+    unsigned int __keymax;
+    void **__keyval;
+};
+
+extern DWORD _pthread_tls;
+extern volatile LONG _pthread_mutex_stats_on;
+extern volatile LONG _pthread_spin_stats_on;
+
+#define _PTHREAD_LIFE_SPINLOCK	0xFEEDBAB1
+#define _PTHREAD_LIFE_MUTEX	0xBAB1F00D
+
+/* Neither static initializer, NULL nor process-shared.  */
+#define _PTHREAD_PLAIN_P(x)	((size_t)(x) + 3 > 3 && ((size_t)(x) & 1) == 0)
+
+static __inline__ struct _pthread_spin_head *
+_pthread_spin_inline_ref(pthread_spinlock_t *l)
+{
+    struct _pthread_spin_head *s;
+
+    if (!l || !_PTHREAD_PLAIN_P(*l))
+      return NULL;
+    s = (struct _pthread_spin_head *) *l;
+    if (s->__valid != _PTHREAD_LIFE_SPINLOCK || _pthread_spin_stats_on)
+      return NULL;
+    return s;
+}
+
+/* Takes the next ticket if it is served at once, as the library does.  */
+static __inline__ int
+_pthread_spin_trylock_inline(pthread_spinlock_t *l)
+{
+    struct _pthread_spin_head *s = _pthread_spin_inline_ref(l);
+    LONG t;
+
+    if (!s)
+      return pthread_spin_trylock(l);
+    t = s->__serving;
+    return (InterlockedCompareExchange(&s->__next, t + 1, t) == t ? 0 : EBUSY);
+}
+
+static __inline__ int
+_pthread_spin_lock_inline(pthread_spinlock_t *l)
+{
+    struct _pthread_spin_head *s = _pthread_spin_inline_ref(l);
+    LONG t;
+
+    if (s)
+    {
+      t = s->__serving;
+      if (InterlockedCompareExchange(&s->__next, t + 1, t) == t)
+	return 0;
+    }
+    return pthread_spin_lock(l);
+}
+
+static __inline__ int
+_pthread_spin_unlock_inline(pthread_spinlock_t *l)
+{
+    struct _pthread_spin_head *s;
+    LONG t;
+
+    if (!l || !_PTHREAD_PLAIN_P(*l))
+      return pthread_spin_unlock(l);
+    s = (struct _pthread_spin_head *) *l;
+    t = s->__serving;
+    if (s->__valid != _PTHREAD_LIFE_SPINLOCK || s->__next == t)
+      return pthread_spin_unlock(l);
+    __asm__ __volatile__ ("" ::: "memory");
+    s->__serving = t + 1;
+    return 0;
+}
+
+static __inline__ struct _pthread_mutex_head *
+_pthread_mutex_inline_ref(pthread_mutex_t *m)
+{
+    struct _pthread_mutex_head *h;
+
+    if (!m)
+      return NULL;
+#ifdef USE_MUTEX_InPlace
+    h = (struct _pthread_mutex_head *) m;
+#else
+    if (!_PTHREAD_PLAIN_P(*m))
+      return NULL;
+    h = (struct _pthread_mutex_head *) *m;
+#endif
+    if (h->__valid != (LONG) _PTHREAD_LIFE_MUTEX || !h->__fast || _pthread_mutex_stats_on)
+      return NULL;
+    return h;
+}
+
+static __inline__ int
+_pthread_mutex_trylock_inline(pthread_mutex_t *m)
+{
+    struct _pthread_mutex_head *h = _pthread_mutex_inline_ref(m);
+
+    if (!h)
+      return pthread_mutex_trylock(m);
+    if (InterlockedCompareExchange(&h->__state, 1, 0) != 0)
+      return EBUSY;
+    h->__count = 1;
+    h->__owner = GetCurrentThreadId();
+    return 0;
+}
+
+static __inline__ int
+_pthread_mutex_lock_inline(pthread_mutex_t *m)
+{
+    struct _pthread_mutex_head *h = _pthread_mutex_inline_ref(m);
+
+    if (h && InterlockedCompareExchange(&h->__state, 1, 0) == 0)
+    {
+      h->__count = 1;
+      h->__owner = GetCurrentThreadId();
+      return 0;
+    }
+    return pthread_mutex_lock(m);
+}
+
+/* Only a mutex without waiters is released inline.  */
+static __inline__ int
+_pthread_mutex_unlock_inline(pthread_mutex_t *m)
+{
+    struct _pthread_mutex_head *h = _pthread_mutex_inline_ref(m);
+
+    if (h && h->__state == 1)
+    {
+      h->__owner = 0;
+      if (InterlockedCompareExchange(&h->__state, 0, 1) == 1)
+	return 0;
+    }
+    return pthread_mutex_unlock(m);
+}
+
+static __inline__ void *
+_pthread_getspecific_inline(pthread_key_t key)
+{
+    struct _pthread_key_head *t;
+
+    if (_pthread_tls != 0xffffffff
+	&& (t = (struct _pthread_key_head *) TlsGetValue(_pthread_tls)) != NULL
+	&& key < t->__keymax)
+      return t->__keyval[key];
+    return pthread_getspecific(key);
+}
+
+#define pthread_spin_lock(l)		_pthread_spin_lock_inline(l)
+#define pthread_spin_trylock(l)		_pthread_spin_trylock_inline(l)
+#define pthread_spin_unlock(l)		_pthread_spin_unlock_inline(l)
+#define pthread_mutex_lock(m)		_pthread_mutex_lock_inline(m)
+#define pthread_mutex_trylock(m)	_pthread_mutex_trylock_inline(m)
+#define pthread_mutex_unlock(m)		_pthread_mutex_unlock_inline(m)
+#define pthread_getspecific(k)		_pthread_getspecific_inline(k)
+
+#endif
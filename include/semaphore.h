@@ -29,6 +29,8 @@ int sem_wait(sem_t *sem);
 
 int sem_timedwait(sem_t * sem, const struct timespec *t);
 
+int sem_reltimedwait_np(sem_t * sem, const struct timespec *rel);
+
 int sem_post(sem_t *sem);
 
 int sem_post_multiple(sem_t *sem, int count);
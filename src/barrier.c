@@ -5,32 +5,33 @@
 #include "ref.h" 
 #include "misc.h"
 #include "spinlock.h"
+#include "pshared.h"
 
-static spin_t barrier_global = {0,LIFE_SPINLOCK,0};
+static spin_stripe barrier_global[SPIN_STRIPES] = SPIN_STRIPES_INITIALIZER("barrier_global");
 
 static __attribute__((noinline)) int
 barrier_unref(volatile pthread_barrier_t *barrier, int res)
 {
-    _spin_lite_lock(&barrier_global);
+    _spin_lite_lock(SPIN_STRIPE(barrier_global, barrier));
 #ifdef WINPTHREAD_DBG
     assert((((barrier_t *)*barrier)->valid == LIFE_BARRIER) && (((barrier_t *)*barrier)->busy > 0));
 #endif
      ((barrier_t *)*barrier)->busy--;
-    _spin_lite_unlock(&barrier_global);
+    _spin_lite_unlock(SPIN_STRIPE(barrier_global, barrier));
     return res;
 }
 
 static __attribute__((noinline)) int barrier_ref(volatile pthread_barrier_t *barrier)
 {
     int r = 0;
-    _spin_lite_lock(&barrier_global);
+    _spin_lite_lock(SPIN_STRIPE(barrier_global, barrier));
 
     if (!barrier || !*barrier || ((barrier_t *)*barrier)->valid != LIFE_BARRIER) r = EINVAL;
     else {
         ((barrier_t *)*barrier)->busy ++;
     }
 
-    _spin_lite_unlock(&barrier_global);
+    _spin_lite_unlock(SPIN_STRIPE(barrier_global, barrier));
 
     return r;
 }
@@ -41,7 +42,8 @@ barrier_ref_destroy(volatile pthread_barrier_t *barrier, pthread_barrier_t *bDes
     int r = 0;
 
     *bDestroy = NULL;
-    if (_spin_lite_trylock(&barrier_global)) return EBUSY;
+    /* The stripe is shared with unrelated barriers, only busy counts.  */
+    _spin_lite_lock(SPIN_STRIPE(barrier_global, barrier));
     
     if (!barrier || !*barrier || ((barrier_t *)*barrier)->valid != LIFE_BARRIER) r = EINVAL;
     else {
@@ -53,22 +55,26 @@ barrier_ref_destroy(volatile pthread_barrier_t *barrier, pthread_barrier_t *bDes
         }
     }
 
-    _spin_lite_unlock(&barrier_global);
+    _spin_lite_unlock(SPIN_STRIPE(barrier_global, barrier));
     return r;
 }
 
 static __attribute__((noinline)) void
 barrier_ref_set (volatile pthread_barrier_t *barrier, void *v)
 {
-  _spin_lite_lock(&barrier_global);
+  _spin_lite_lock(SPIN_STRIPE(barrier_global, barrier));
   *barrier = v;
-  _spin_lite_unlock(&barrier_global);
+  _spin_lite_unlock(SPIN_STRIPE(barrier_global, barrier));
 }
 
 int pthread_barrier_destroy(pthread_barrier_t *b_)
 {
     pthread_barrier_t bDestroy;
-    int r = barrier_ref_destroy(b_,&bDestroy);
+    int r;
+
+    if (b_ && PSHARED_P(*b_))
+      return _pshared_barrier_destroy(b_);
+    r = barrier_ref_destroy(b_,&bDestroy);
     
     if (r)
       return r;
@@ -111,6 +117,8 @@ pthread_barrier_init (pthread_barrier_t *b_, const void *attr, unsigned int coun
 
     if (!count || !b_)
       return EINVAL;
+    if (attr && *((int **)attr) != NULL && **((int **)attr) == PTHREAD_PROCESS_SHARED)
+      return _pshared_barrier_init(b_, count);
 
     if (!(b = (pthread_barrier_t)calloc(1,sizeof(*b))))
        return ENOMEM;
@@ -152,6 +160,8 @@ int pthread_barrier_wait(pthread_barrier_t *b_)
   long sel;
   int r, e, rslt;
 
+  if (b_ && PSHARED_P(*b_))
+    return _pshared_barrier_wait(b_);
   r = barrier_ref(b_);
   if(r) return r;
 
@@ -6,24 +6,15 @@
 #include <stdio.h>
 #include "pthread.h"
 #include "ref.h"
-#include "cond.h"
 #include "mutex.h"
+#include "cond.h"
 #include "spinlock.h"
 #include "thread.h"
 #include "misc.h"
+#include "pshared.h"
 
 int __pthread_shallcancel (void);
 
-static int do_sema_b_wait (HANDLE sema, int nointerrupt, DWORD timeout,CRITICAL_SECTION *cs, LONG *val);
-static int do_sema_b_release(HANDLE sema, LONG count,CRITICAL_SECTION *cs, LONG *val);
-static void cleanup_wait(void *arg);
-
-typedef struct sCondWaitHelper {
-    cond_t *c;
-    pthread_mutex_t *external_mutex;
-    int *r;
-} sCondWaitHelper;
-
 int do_sema_b_wait_intern (HANDLE sema, int nointerrupt, DWORD timeout);
 
 #ifdef WINPTHREAD_DBG
@@ -43,35 +34,53 @@ void cond_print(volatile pthread_cond_t *c, char *txt)
     if (c_ == NULL) {
         fprintf(fo,"C%p %d %s\n",*c,(int)GetCurrentThreadId(),txt);
     } else {
-        fprintf(fo,"C%p %d V=%0X B=%d b=%p w=%ld %s\n",
+        fprintf(fo,"C%p %d V=%0X B=%d %s\n",
             *c, 
             (int)GetCurrentThreadId(), 
             (int)c_->valid, 
             (int)c_->busy,
-            NULL,
-            c_->waiters_count_,
             txt
             );
     }
 }
 #endif
 
-static spin_t cond_locked = {0,LIFE_SPINLOCK,0};
+/* Allocates the state of a condition variable.  There are no kernel
+   objects in it, waiters block on events of their threads.  */
+static int
+cond_alloc(pthread_cond_t *c, clockid_t clock)
+{
+    cond_t *_c;
 
+    if ( !(_c = (pthread_cond_t)calloc(1,sizeof(*_c))) ) {
+        return ENOMEM; 
+    }
+#if defined USE_COND_ConditionVariable
+    InitializeConditionVariable(&_c->cv);
+    InitializeSRWLock(&_c->guard);
+#endif
+    _c->clock = clock;
+    _c->valid = LIFE_COND;
+    *c = _c;
+    return 0;
+}
+
+/* Initializes privately and publishes with a compare-and-swap over
+   the static initializer, the loser of a race frees its copy.  */
 static int cond_static_init(pthread_cond_t *c)
 {
-  int r = 0;
-  
-  _spin_lite_lock(&cond_locked);
-  if (c == NULL)
-    r = EINVAL;
-  else if (*c == PTHREAD_COND_INITIALIZER)
-    r = pthread_cond_init (c, NULL);
-  else
-    /* We assume someone was faster ... */
-    r = 0;
-  _spin_lite_unlock(&cond_locked);
-  return r;
+  pthread_cond_t nc = NULL;
+  int r;
+
+  if (*c != PTHREAD_COND_INITIALIZER)
+    /* NULL is destroyed, otherwise we assume someone was faster ... */
+    return (*c == NULL ? EINVAL : 0);
+  r = cond_alloc (&nc, CLOCK_REALTIME);
+  if (r != 0)
+    return r;
+  if (InterlockedCompareExchangePointer(c, nc, PTHREAD_COND_INITIALIZER) != PTHREAD_COND_INITIALIZER)
+    pthread_cond_destroy (&nc);
+  return 0;
 }
 
 int pthread_condattr_destroy(pthread_condattr_t *a)
@@ -86,7 +95,7 @@ int pthread_condattr_init(pthread_condattr_t *a)
 {
   if (!a)
     return EINVAL;
-  *a = 0;
+  *a = CONDATTR_MAKE(PTHREAD_PROCESS_PRIVATE, CLOCK_REALTIME);
   return 0;
 }
 
@@ -94,7 +103,7 @@ int pthread_condattr_getpshared(const pthread_condattr_t *a, int *s)
 {
   if (!a || !s)
     return EINVAL;
-  *s = *a;
+  *s = CONDATTR_PSHARED(*a);
   return 0;
 }
 
@@ -102,522 +111,740 @@ int pthread_condattr_setpshared(pthread_condattr_t *a, int s)
 {
   if (!a || (s != PTHREAD_PROCESS_SHARED && s != PTHREAD_PROCESS_PRIVATE))
     return EINVAL;
-  if (s == PTHREAD_PROCESS_SHARED)
-  {
-     *a = PTHREAD_PROCESS_PRIVATE;
-     return ENOSYS;
-  }
-  *a = s;
+  *a = CONDATTR_MAKE(s, CONDATTR_CLOCK(*a));
   return 0;
 }
 
-int pthread_cond_init(pthread_cond_t *c, const pthread_condattr_t *a)
+int pthread_condattr_getclock(const pthread_condattr_t *a, clockid_t *clock_id)
 {
-    cond_t *_c;
-    int r = 0;
-    
-    if (!c)
-      return EINVAL;
-    if (a && *a == PTHREAD_PROCESS_SHARED)
-      return ENOSYS;
+  if (!a || !clock_id)
+    return EINVAL;
+  *clock_id = CONDATTR_CLOCK(*a);
+  return 0;
+}
 
-    if ( !(_c = (pthread_cond_t)calloc(1,sizeof(*_c))) ) {
-        return ENOMEM; 
-    }
-    _c->valid  = DEAD_COND;
-
-    _c->waiters_count_ = 0;
-    _c->waiters_count_gone_ = 0;
-    _c->waiters_count_unblock_ = 0;
-
-    _c->sema_q = CreateSemaphore (NULL,       /* no security */
-        0,          /* initially 0 */
-        0x7fffffff, /* max count */
-        NULL);      /* unnamed  */
-    _c->sema_b =  CreateSemaphore (NULL,       /* no security */
-        0,          /* initially 0 */
-        0x7fffffff, /* max count */
-        NULL);  
-    if (_c->sema_q == NULL || _c->sema_b == NULL) {
-        if (_c->sema_q != NULL)
-          CloseHandle (_c->sema_q);
-        if (_c->sema_b != NULL)
-          CloseHandle (_c->sema_b);
-        free (_c);
-        r = EAGAIN;
-    } else {
-        InitializeCriticalSection(&_c->waiters_count_lock_);
-        InitializeCriticalSection(&_c->waiters_b_lock_);
-        InitializeCriticalSection(&_c->waiters_q_lock_);
-        _c->value_q = 0;
-        _c->value_b = 1;
-    }
-    if (!r)
+/* Timed waits on a condition variable with CLOCK_MONOTONIC don't care
+   if the wall clock is set meanwhile.  */
+int pthread_condattr_setclock(pthread_condattr_t *a, clockid_t clock_id)
+{
+  if (!a || (clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC))
+    return EINVAL;
+  *a = CONDATTR_MAKE(CONDATTR_PSHARED(*a), clock_id);
+  return 0;
+}
+
+/* Milliseconds left until t on the clock of _c, or the relative rel
+   without t, which is INFINITE for untimed waits.  */
+static DWORD
+cond_timeout(cond_t *_c, const struct timespec *t, DWORD rel)
+{
+    return (t ? dwMilliSecs(_pthread_clock_rel_time_in_ms(_c->clock, t)) : rel);
+}
+
+#if defined USE_COND_ConditionVariable
+/* Native condition variables, see cond_t.  They can't wait for evStart,
+   so a waiter which can be canceled leaves its cond_t with its thread
+   for pthread_cancel to wake it, see _cond_cancel_wake.  */
+static void
+cond_cancel_register(struct _pthread_v *self, cond_t *_c)
+{
+    pthread_mutex_lock(&self->p_clock);
+    self->cv_wait = _c;
+    pthread_mutex_unlock(&self->p_clock);
+}
+
+/* Called by pthread_cancel with p_clock of the waiter held, which keeps
+   _c from going away.  Taking the guard makes sure a waiter which
+   didn't see the request yet already sleeps.  Other waiters find no
+   signal for them and go back to sleep.  */
+void
+_cond_cancel_wake(cond_t *_c)
+{
+    AcquireSRWLockExclusive(&_c->guard);
+    WakeAllConditionVariable(&_c->cv);
+    ReleaseSRWLockExclusive(&_c->guard);
+}
+
+/* Takes one of the signals sent since seq, with the guard held shared.
+   A waiter which gets one was signaled, no matter which thread the
+   condition variable woke up for it.  */
+static int
+cond_claim(cond_t *_c, LONG seq)
+{
+    LONG n;
+
+    if (_c->seq == seq)
+      return 0;
+    while ((n = _c->signals) > 0)
+      if (InterlockedCompareExchange(&_c->signals, n - 1, n) == n)
+	return 1;
+    return 0;
+}
+
+/* Drops a waiter which wasn't signaled, with the guard held shared.  */
+static void
+cond_unwait(cond_t *_c)
+{
+    LONG n;
+
+    while ((n = _c->waiters) > 0
+	   && InterlockedCompareExchange(&_c->waiters, n - 1, n) != n)
+      ;
+}
+
+static void
+cond_signal(cond_t *_c, int all)
+{
+    /* If there aren't any waiters, then this is a no-op.   */
+    if (_c->busy == 0)
+      return;
+    AcquireSRWLockExclusive(&_c->guard);
+    if (_c->waiters > 0)
     {
-        _c->valid = LIFE_COND;
-        *c = _c;
+      _c->seq += 1;
+      if (all)
+      {
+	_c->signals += _c->waiters;
+	_c->waiters = 0;
+	WakeAllConditionVariable(&_c->cv);
+      }
+      else
+      {
+	_c->waiters -= 1;
+	_c->signals += 1;
+	WakeConditionVariable(&_c->cv);
+      }
     }
-    else
-      *c = NULL;
-    return r;
+    ReleaseSRWLockExclusive(&_c->guard);
 }
 
-int pthread_cond_destroy(pthread_cond_t *c)
+static int
+cond_wait(cond_t *_c, pthread_mutex_t *m, const struct timespec *t, DWORD rel)
 {
-    cond_t *_c;
-    int r;
-    if (!c || !*c)
-      return EINVAL;
-    if (*c == PTHREAD_COND_INITIALIZER)
+    struct _pthread_v *self = pthread_self().p;
+    DWORD timeout, t0 = GetTickCount(), dt;
+    int r = 0, r2, canceled = 0, signaled = 0;
+    LONG seq;
+
+    if (self != NULL && (self->p_state & PTHREAD_CANCEL_ENABLE) == 0)
+      self = NULL;
+    timeout = cond_timeout(_c, t, rel);
+    InterlockedIncrement(&_c->busy);
+    if (self)
+      cond_cancel_register(self, _c);
+    AcquireSRWLockShared(&_c->guard);
+    InterlockedIncrement(&_c->waiters);
+    seq = _c->seq;
+    if ((r = pthread_mutex_unlock(m)) != 0)
     {
-        _spin_lite_lock(&cond_locked);
-        if (*c == PTHREAD_COND_INITIALIZER)
-        {
-          *c = NULL;
-          r = 0;
-	}
-        else
-          r = EBUSY;
-        _spin_lite_unlock(&cond_locked);
-        return r;
-    }
-    _c = (cond_t *) *c;
-    r = do_sema_b_wait(_c->sema_b, 0, INFINITE,&_c->waiters_b_lock_,&_c->value_b);
-    if (r != 0)
+      cond_unwait(_c);
+      ReleaseSRWLockShared(&_c->guard);
+      if (self)
+	cond_cancel_register(self, NULL);
+      InterlockedDecrement(&_c->busy);
       return r;
-    if (!TryEnterCriticalSection(&_c->waiters_count_lock_))
+    }
+    /* Wakeups without a signal for us, spurious ones and those of
+       _cond_cancel_wake, just go back to sleep.  */
+    for (;;)
     {
-       do_sema_b_release (_c->sema_b, 1,&_c->waiters_b_lock_,&_c->value_b);
-       return EBUSY;
+      if ((signaled = cond_claim(_c, seq)) != 0)
+      {
+	r = 0;
+	break;
+      }
+      if (r != 0 || canceled)
+      {
+	cond_unwait(_c);
+	break;
+      }
+      if (self && __pthread_shallcancel())
+      {
+	canceled = 1;
+	continue;
+      }
+      if (!SleepConditionVariableSRW(&_c->cv, &_c->guard, timeout, CONDITION_VARIABLE_LOCKMODE_SHARED)
+	  && GetLastError() != ERROR_TIMEOUT)
+	r = EINVAL;
+      else if (timeout != INFINITE)
+      {
+	dt = GetTickCount() - t0;
+	if ((timeout = (t ? cond_timeout(_c, t, 0) : (dt < rel ? rel - dt : 0))) == 0)
+	  r = ETIMEDOUT;
+      }
     }
-    if (_c->waiters_count_ > _c->waiters_count_gone_ || _c->busy != 0)
+    ReleaseSRWLockShared(&_c->guard);
+    if (self)
+      cond_cancel_register(self, NULL);
+    /* Hand a signal we won't act on to another waiter.  */
+    if (signaled && canceled)
+      cond_signal(_c, 0);
+    InterlockedDecrement(&_c->busy);
+    r2 = pthread_mutex_lock(m);
+    /* Cancellation handlers run with the mutex locked again.  */
+    if (canceled)
+      pthread_testcancel();
+    return (r2 != 0 ? r2 : r);
+}
+
+/* Signaled waiters may still have to let go of the guard.  */
+static int
+cond_destroy(pthread_cond_t *c, cond_t *_c)
+{
+    AcquireSRWLockExclusive(&_c->guard);
+    if (_c->waiters != 0)
     {
-      r = do_sema_b_release (_c->sema_b, 1,&_c->waiters_b_lock_,&_c->value_b);
-      if (!r) r = EBUSY;
-      LeaveCriticalSection(&_c->waiters_count_lock_);
-      return r;
+      ReleaseSRWLockExclusive(&_c->guard);
+      return EBUSY;
     }
     *c = NULL;
-    do_sema_b_release (_c->sema_b, 1,&_c->waiters_b_lock_,&_c->value_b);
-      
-    if (!CloseHandle(_c->sema_q))
-      if (!r)
-        r = EINVAL;
-    if (!CloseHandle(_c->sema_b))
-      if (!r)
-        r = EINVAL;
-    LeaveCriticalSection (&_c->waiters_count_lock_);
-    DeleteCriticalSection(&_c->waiters_count_lock_);
-    DeleteCriticalSection(&_c->waiters_b_lock_);
-    DeleteCriticalSection(&_c->waiters_q_lock_);
-    _c->valid  = DEAD_COND;
+    _c->valid = DEAD_COND;
+    ReleaseSRWLockExclusive(&_c->guard);
+    while (_c->busy != 0)
+      Sleep(0);
     free(_c);
     return 0;
 }
 
-int pthread_cond_signal (pthread_cond_t *c)
+#else /* USE_COND_Queue */
+/* Waiters queue up in arrival order and sleep on their own event, see
+   cond_waiter, so a signal wakes exactly one of them and nobody has to
+   hold a lock while blocking.  A waiter spins on its node for a while
+   first, as the signal often comes right after it.
+
+   Signaled waiters are moved over to the queue of their mutex while it
+   is locked, see _mutex_requeue, and only wake up once they own it.  So
+   a broadcast doesn't wake all waiters at once just to have them block
+   on the mutex again.
+
+   A thread can wait on several condition variables at once, see
+   pthread_cond_wait_any_np.  It has an entry on each queue and takes
+   the others out once one signal claimed it.  */
+
+/* Short-term lock of the waiter queue, never held while blocking.  */
+static void
+cond_qlock(cond_t *_c)
 {
-    cond_t *_c;
-    int r;
-    
-    if (!c || !*c)
-      return EINVAL;
-    _c = (cond_t *)*c;
-    if (_c == (cond_t *)PTHREAD_COND_INITIALIZER)
-      return 0;
-    else if (_c->valid != (unsigned int)LIFE_COND)
-      return EINVAL;
+    while (InterlockedExchange(&_c->qlock, 1) != 0)
+    {
+      while (_c->qlock != 0)
+	YieldProcessor();
+    }
+}
 
-    EnterCriticalSection (&_c->waiters_count_lock_);
-    /* If there aren't any waiters, then this is a no-op.   */
-    if (_c->waiters_count_unblock_ != 0)
+#define cond_qunlock(c_)	InterlockedExchange(&(c_)->qlock, 0)
+
+/* Unlinks the first entry whose waiter is still waiting and claims
+   the waiter through it, NULL if there is none.  Called with qlock
+   held.  Entries of waiters gone or claimed elsewhere are dropped, their
+   waiter accounts for them in cond_unlink.  */
+static cond_entry *
+cond_claim(cond_t *_c)
+{
+    cond_entry *e;
+
+    while ((e = _c->qhead) != NULL)
     {
-      if (_c->waiters_count_ == 0)
+      if ((_c->qhead = e->next) == NULL)
+	_c->qtail = NULL;
+      e->next = NULL;
+      if (InterlockedCompareExchange(&e->w->claim, COND_W_CLAIMED + e->index, 0) == 0)
       {
-	LeaveCriticalSection (&_c->waiters_count_lock_);
-	pthread_testcancel();
-	return 0;
+	_c->busy--;
+	return e;
       }
-      _c->waiters_count_ -= 1;
-      _c->waiters_count_unblock_ += 1;
     }
-    else if (_c->waiters_count_ > _c->waiters_count_gone_)
+    return NULL;
+}
+
+/* Requeues a claimed waiter onto its mutex, or wakes it up if that
+   isn't possible.  The waiter doesn't touch the condition variable
+   anymore, and w is gone as soon as it runs.  */
+static void
+cond_wake(cond_waiter *w)
+{
+    HANDLE ev = w->q.ev;
+
+    if (_mutex_requeue(w->m, &w->q) == 0)
+      return;
+    if (InterlockedExchange(&w->q.state, COND_W_SIGNALED) == MUTEX_Q_PARKED)
+      SetEvent(ev);
+}
+
+/* Wakes the first waiter, or all of them.  */
+static void
+cond_signal(cond_t *_c, int all)
+{
+    cond_entry *e, *n, *head = NULL, *tail = NULL;
+
+    /* If there aren't any waiters, then this is a no-op.   */
+    if (_c->qhead == NULL)
+      return;
+    cond_qlock(_c);
+    while ((e = cond_claim(_c)) != NULL)
     {
-    	r = do_sema_b_wait (_c->sema_b, 1, INFINITE,&_c->waiters_b_lock_,&_c->value_b);
-    	if (r != 0)
-    	{
-    	  LeaveCriticalSection (&_c->waiters_count_lock_);
-	  pthread_testcancel();
-    	  return r;
-    	}
-    	if (_c->waiters_count_gone_ != 0)
-    	{
-    	  _c->waiters_count_ -= _c->waiters_count_gone_;
-    	  _c->waiters_count_gone_ = 0;
-    	}
-    	_c->waiters_count_ -= 1;
-    	_c->waiters_count_unblock_ = 1;
+      if (tail)
+	tail->next = e;
+      else
+	head = e;
+      tail = e;
+      if (!all)
+	break;
+    }
+    cond_qunlock(_c);
+    for (e = head; e != NULL; e = n)
+    {
+      n = e->next;
+      cond_wake(e->w);
+    }
+}
+
+/* Takes e off its queue, unless a signal did already.  */
+static void
+cond_unlink(cond_entry *e)
+{
+    cond_t *_c = e->c;
+    cond_entry *p;
+
+    cond_qlock(_c);
+    if (_c->qhead == e)
+    {
+      if ((_c->qhead = e->next) == NULL)
+	_c->qtail = NULL;
     }
     else
     {
-	LeaveCriticalSection (&_c->waiters_count_lock_);
-	pthread_testcancel();
-	return 0;
+      for (p = _c->qhead; p != NULL && p->next != e; p = p->next)
+	;
+      if (p != NULL && (p->next = e->next) == NULL)
+	_c->qtail = p;
     }
-    LeaveCriticalSection (&_c->waiters_count_lock_);
-    r = do_sema_b_release(_c->sema_q, 1,&_c->waiters_q_lock_,&_c->value_q);
-    pthread_testcancel();
-    return r;
+    _c->busy--;
+    cond_qunlock(_c);
 }
 
-int pthread_cond_broadcast (pthread_cond_t *c)
+/* Leaves the queues of all n entries but the one claimed, k.  */
+static void
+cond_leave(cond_entry *e, int n, int k)
 {
-    cond_t *_c;
-    int r;
-    int relCnt = 0;    
+    int i;
 
-    if (!c || !*c)
-      return EINVAL;
-    _c = (cond_t *)*c;
-    if (_c == (cond_t*)PTHREAD_COND_INITIALIZER)
+    for (i = 0; i < n; i++)
+    {
+      if (i != k)
+	cond_unlink(&e[i]);
+    }
+}
+
+/* Gives up waiting after a timeout or an error.  Returns -1 if the
+   waiter left all queues, or the index of the entry through which a
+   signal claimed it first, which then sets the park event of a parked
+   waiter.  */
+static int
+cond_abandon(cond_entry *e, int n)
+{
+    LONG c = InterlockedCompareExchange(&e->w->claim, COND_W_GONE, 0);
+    int k = (c != 0 ? (int) (c - COND_W_CLAIMED) : -1);
+
+    cond_leave(e, n, k);
+    return k;
+}
+
+/* Gets the mutex back after a wakeup.  */
+static int
+cond_relock(cond_waiter *w)
+{
+    if (w->q.state == MUTEX_Q_GRANTED)
+    {
+      _mutex_granted(w->m);
       return 0;
-    else if (_c->valid != (unsigned int)LIFE_COND)
-      return EINVAL;
+    }
+    return pthread_mutex_lock(w->m);
+}
 
-    EnterCriticalSection (&_c->waiters_count_lock_);
-    /* If there aren't any waiters, then this is a no-op.   */
-    if (_c->waiters_count_unblock_ != 0)
+/* Waits on the condition variables of the n entries at once, until a
+   signal on one of them, whose index goes to *which.  Timeouts are on
+   the clock of the first.  */
+static int
+cond_wait_any(cond_entry *e, int n, pthread_mutex_t *m, const struct timespec *t, DWORD rel, int *which)
+{
+    cond_waiter w;
+    cond_t *_c;
+    DWORD timeout;
+    int i, k = -1, r = 0, r2, cnt;
+
+    if ((w.q.ev = _pthread_get_park_event()) == NULL)
+      return ENOMEM;
+    w.q.next = NULL;
+    w.q.state = MUTEX_Q_WAITING;
+    w.claim = 0;
+    w.m = m;
+
+    /* Queued before m is unlocked, so no signal can slip through.  */
+    for (i = 0; i < n; i++)
+    {
+      _c = e[i].c;
+      e[i].next = NULL;
+      e[i].w = &w;
+      e[i].index = i;
+      cond_qlock(_c);
+      if (_c->qtail)
+	_c->qtail->next = &e[i];
+      else
+	_c->qhead = &e[i];
+      _c->qtail = &e[i];
+      _c->busy++;
+      cond_qunlock(_c);
+    }
+
+    if ((r = pthread_mutex_unlock(m)) != 0)
     {
-      if (_c->waiters_count_ == 0)
+      if ((k = cond_abandon(e, n)) >= 0)
       {
-	LeaveCriticalSection (&_c->waiters_count_lock_);
-	pthread_testcancel();
-	return 0;
+	/* Signaled meanwhile, pass it on.  */
+	if (InterlockedCompareExchange(&w.q.state, MUTEX_Q_PARKED, MUTEX_Q_WAITING) == MUTEX_Q_WAITING)
+	  WaitForSingleObject(w.q.ev, INFINITE);
+	if (w.q.state == MUTEX_Q_GRANTED)
+	{
+	  _mutex_granted(m);
+	  pthread_mutex_unlock(m);
+	}
+	cond_signal(e[k].c, 0);
       }
-      relCnt = _c->waiters_count_;
-      _c->waiters_count_ = 0;
-      _c->waiters_count_unblock_ += relCnt;
+      return r;
     }
-    else if (_c->waiters_count_ > _c->waiters_count_gone_)
+
+    timeout = cond_timeout(e[0].c, t, rel);
+    if (_pthread_num_cpus() > 1 && timeout != 0)
     {
-    	r = do_sema_b_wait (_c->sema_b, 1, INFINITE,&_c->waiters_b_lock_,&_c->value_b);
-    	if (r != 0)
-    	{
-    	  LeaveCriticalSection (&_c->waiters_count_lock_);
-	  pthread_testcancel();
-    	  return r;
-    	}
-    	if (_c->waiters_count_gone_ != 0)
-    	{
-    	  _c->waiters_count_ -= _c->waiters_count_gone_;
-    	  _c->waiters_count_gone_ = 0;
-    	}
-    	relCnt = _c->waiters_count_;
-    	_c->waiters_count_ = 0;
-    	_c->waiters_count_unblock_ = relCnt;
+      for (cnt = 0; cnt < USE_COND_SpinCount && w.q.state == MUTEX_Q_WAITING; cnt++)
+	YieldProcessor();
     }
-    else
+    if (InterlockedCompareExchange(&w.q.state, MUTEX_Q_PARKED, MUTEX_Q_WAITING) == MUTEX_Q_WAITING)
     {
-	LeaveCriticalSection (&_c->waiters_count_lock_);
-	pthread_testcancel();
-	return 0;
+      /* The wait may end a little before t, by the timer resolution.  */
+      while ((r = do_sema_b_wait_intern(w.q.ev, 2, timeout)) == ETIMEDOUT
+	     && t != NULL && (timeout = cond_timeout(e[0].c, t, 0)) != 0)
+	;
+      if (r != 0)
+      {
+	if ((k = cond_abandon(e, n)) < 0)
+	{
+	  if (which)
+	    *which = -1;
+	  r2 = pthread_mutex_lock(m);
+	  /* Cancellation handlers run with the mutex locked again.  */
+	  if (r != ETIMEDOUT)
+	    pthread_testcancel();
+	  return (r2 != 0 ? r2 : r);
+	}
+	/* Timed out or canceled too late, the signal counts.  */
+	WaitForSingleObject(w.q.ev, INFINITE);
+      }
+    }
+    if (r == 0)
+    {
+      k = (int) (w.claim - COND_W_CLAIMED);
+      if (n > 1)
+	cond_leave(e, n, k);
     }
-    LeaveCriticalSection (&_c->waiters_count_lock_);
-    r = do_sema_b_release(_c->sema_q, relCnt,&_c->waiters_q_lock_,&_c->value_q);
+    if (which)
+      *which = k;
+    return cond_relock(&w);
+}
+
+static int
+cond_wait(cond_t *_c, pthread_mutex_t *m, const struct timespec *t, DWORD rel)
+{
+    cond_entry e;
+
+    e.c = _c;
+    return cond_wait_any(&e, 1, m, t, rel, NULL);
+}
+
+/* Claimed waiters don't look at the condition variable anymore.  */
+static int
+cond_destroy(pthread_cond_t *c, cond_t *_c)
+{
+    cond_qlock(_c);
+    if (_c->busy != 0)
+    {
+      cond_qunlock(_c);
+      return EBUSY;
+    }
+    *c = NULL;
+    _c->valid = DEAD_COND;
+    cond_qunlock(_c);
+    free(_c);
+    return 0;
+}
+
+#endif
+
+int pthread_cond_init(pthread_cond_t *c, const pthread_condattr_t *a)
+{
+    if (!c)
+      return EINVAL;
+    if (a && CONDATTR_PSHARED(*a) == PTHREAD_PROCESS_SHARED)
+      return _pshared_cond_init(c, CONDATTR_CLOCK(*a));
+    /* Many condition variables are never waited for.  With the default
+       clock they stay statically initialized until the first wait, see
+       cond_static_init, and signals on them return without a lookup.  */
+    if (!a || CONDATTR_CLOCK(*a) == CLOCK_REALTIME)
+    {
+      *c = PTHREAD_COND_INITIALIZER;
+      return 0;
+    }
+    return cond_alloc(c, CONDATTR_CLOCK(*a));
+}
+
+int pthread_cond_destroy(pthread_cond_t *c)
+{
+    cond_t *_c;
+
+    if (!c || !*c)
+      return EINVAL;
+    if (PSHARED_P(*c))
+      return _pshared_cond_destroy(c);
+    if (*c == PTHREAD_COND_INITIALIZER)
+    {
+        /* Fails if someone initializes it concurrently.  */
+        if (InterlockedCompareExchangePointer(c, NULL, PTHREAD_COND_INITIALIZER) != PTHREAD_COND_INITIALIZER)
+          return EBUSY;
+        return 0;
+    }
+    _c = (cond_t *) *c;
+    if (_c->valid != (unsigned int)LIFE_COND)
+      return EINVAL;
+    return cond_destroy(c, _c);
+}
+
+int pthread_cond_signal (pthread_cond_t *c)
+{
+    cond_t *_c;
+    
+    if (!c)
+      return EINVAL;
+    _c = (cond_t *)*c;
+    /* A static initializer has no waiters.  */
+    if (STATIC_OR_NULL(_c))
+      return (_c != NULL ? 0 : EINVAL);
+    else if (PSHARED_P(_c))
+      return _pshared_cond_signal(c, 0);
+    else if (_c->valid != (unsigned int)LIFE_COND)
+      return EINVAL;
+
+    cond_signal(_c, 0);
     pthread_testcancel();
-    return r;
+    return 0;
 }
 
+int pthread_cond_broadcast (pthread_cond_t *c)
+{
+    cond_t *_c;
+
+    if (!c)
+      return EINVAL;
+    _c = (cond_t *)*c;
+    /* A static initializer has no waiters.  */
+    if (STATIC_OR_NULL(_c))
+      return (_c != NULL ? 0 : EINVAL);
+    else if (PSHARED_P(_c))
+      return _pshared_cond_signal(c, 1);
+    else if (_c->valid != (unsigned int)LIFE_COND)
+      return EINVAL;
+
+    cond_signal(_c, 1);
+    pthread_testcancel();
+    return 0;
+}
 
 int pthread_cond_wait (pthread_cond_t *c, pthread_mutex_t *external_mutex)
 {
-    sCondWaitHelper ch;
     cond_t *_c;
     int r;
 
     pthread_testcancel();
 
-    if (!c || *c == NULL)
+    if (!c)
       return EINVAL;
     _c = (cond_t *)*c;
-    if (*c == PTHREAD_COND_INITIALIZER)
+    if (STATIC_OR_NULL(_c))
     {
       r = cond_static_init(c);
       if (r != 0 && r != EBUSY)
         return r;
       _c = (cond_t *) *c;
-    } else if (_c->valid != (unsigned int)LIFE_COND)
+    } else if (PSHARED_P(_c))
+      return _pshared_cond_wait(c, external_mutex, NULL, INFINITE);
+    else if (_c->valid != (unsigned int)LIFE_COND)
       return EINVAL;
-    
-    r = do_sema_b_wait (_c->sema_b, 0, INFINITE,&_c->waiters_b_lock_,&_c->value_b);
-    if (r != 0)
-      return r;
-    EnterCriticalSection (&_c->waiters_count_lock_);
-    _c->waiters_count_++;
-    LeaveCriticalSection(&_c->waiters_count_lock_);
-    r = do_sema_b_release (_c->sema_b, 1,&_c->waiters_b_lock_,&_c->value_b);
-    if (r != 0)
-      return r;
-
-    ch.c = _c;
-    ch.r = &r;
-    ch.external_mutex = external_mutex;
-    
-    pthread_cleanup_push(cleanup_wait, (void *) &ch);
-    r = pthread_mutex_unlock(external_mutex);
-    if (!r)
-      r = do_sema_b_wait (_c->sema_q, 0, INFINITE,&_c->waiters_q_lock_,&_c->value_q);
 
-    pthread_cleanup_pop(1);
-    return r;
+    return cond_wait(_c, external_mutex, NULL, INFINITE);
 }
 
 int pthread_cond_timedwait(pthread_cond_t *c, pthread_mutex_t *external_mutex, const struct timespec *t)
 {
-    sCondWaitHelper ch;
-    DWORD dwr;
     int r;
     cond_t *_c;
 
     pthread_testcancel();
 
-    if (!c || !*c)
+    if (!c)
       return EINVAL;
     _c = (cond_t *)*c;
-    if (_c == (cond_t *)PTHREAD_COND_INITIALIZER)
+    if (STATIC_OR_NULL(_c))
     {
       r = cond_static_init(c);
       if (r && r != EBUSY)
         return r;
       _c = (cond_t *) *c;
-    } else if ((_c)->valid != (unsigned int)LIFE_COND)
+    } else if (PSHARED_P(_c))
+      return _pshared_cond_wait(c, external_mutex, t, 0);
+    else if ((_c)->valid != (unsigned int)LIFE_COND)
       return EINVAL;
 
-    dwr = dwMilliSecs(_pthread_rel_time_in_ms(t));
-    r = do_sema_b_wait (_c->sema_b, 0, INFINITE,&_c->waiters_b_lock_,&_c->value_b);
-    if (r != 0)
-      return r;
-    _c->waiters_count_++;
-    r = do_sema_b_release (_c->sema_b, 1,&_c->waiters_b_lock_,&_c->value_b);
-    if (r != 0)
-      return r;
+    return cond_wait(_c, external_mutex, t, 0);
+}
 
-    ch.c = _c;
-    ch.r = &r;
-    ch.external_mutex = external_mutex;
-    
-    pthread_cleanup_push(cleanup_wait, (void *) &ch);
+/* Like pthread_cond_timedwait, but waits for the relative time rel,
+   without reading any clock.  */
+int pthread_cond_reltimedwait_np(pthread_cond_t *c, pthread_mutex_t *external_mutex, const struct timespec *rel)
+{
+    DWORD timeout;
+    int r;
+    cond_t *_c;
 
-    r = pthread_mutex_unlock(external_mutex);
-    if (!r)
-      r = do_sema_b_wait (_c->sema_q, 0, dwr,&_c->waiters_q_lock_,&_c->value_q);
+    pthread_testcancel();
 
-    pthread_cleanup_pop(1);
-    return r;
+    if (!c || !rel)
+      return EINVAL;
+    timeout = dwMilliSecs(_pthread_rel_timespec_in_ms(rel));
+    _c = (cond_t *)*c;
+    if (STATIC_OR_NULL(_c))
+    {
+      r = cond_static_init(c);
+      if (r && r != EBUSY)
+        return r;
+      _c = (cond_t *) *c;
+    } else if (PSHARED_P(_c))
+      return _pshared_cond_wait(c, external_mutex, NULL, timeout);
+    else if ((_c)->valid != (unsigned int)LIFE_COND)
+      return EINVAL;
+
+    return cond_wait(_c, external_mutex, NULL, timeout);
 }
 
-static void cleanup_wait(void *arg)
+/* Waits until one of the n condition variables of cv is signaled and
+   stores its index in *which, or -1 after a timeout.  They all have to
+   be private and use the same clock.  */
+int pthread_cond_wait_any_np(pthread_cond_t **cv, int n, pthread_mutex_t *m, const struct timespec *abstime, int *which)
 {
-  int n, r;
-  sCondWaitHelper *ch = (sCondWaitHelper *) arg;
-  cond_t *_c;
+    /* Defined on every path, not only after a wakeup.  */
+    if (which)
+      *which = -1;
+#if defined USE_COND_ConditionVariable
+    /* A native condition variable can't be waited for along with
+       others.  */
+    (void) cv; (void) n; (void) m; (void) abstime;
+    return ENOTSUP;
+#else
+    cond_entry e_stack[16], *e = e_stack;
+    cond_t *_c;
+    int i, j, r = 0;
 
-  _c = ch->c;
-  EnterCriticalSection (&_c->waiters_count_lock_);
-  n = _c->waiters_count_unblock_;
-  if (n != 0)
-    _c->waiters_count_unblock_ -= 1;
-  else if ((INT_MAX/2) - 1 == _c->waiters_count_gone_)
-  {
-    _c->waiters_count_gone_ += 1;
-    r = do_sema_b_wait (_c->sema_b, 1, INFINITE,&_c->waiters_b_lock_,&_c->value_b);
-    if (r != 0)
-    {
-      LeaveCriticalSection(&_c->waiters_count_lock_);
-      ch->r[0] = r;
-      return;
-    }
-    _c->waiters_count_ -= _c->waiters_count_gone_;
-    r = do_sema_b_release (_c->sema_b, 1,&_c->waiters_b_lock_,&_c->value_b);
-    if (r != 0)
-    {
-      LeaveCriticalSection(&_c->waiters_count_lock_);
-      ch->r[0] = r;
-      return;
-    }
-    _c->waiters_count_gone_ = 0;
-  }
-  else
-    _c->waiters_count_gone_ += 1;
-  LeaveCriticalSection (&_c->waiters_count_lock_);
+    pthread_testcancel();
 
-  if (n == 1)
-  {
-    r = do_sema_b_release (_c->sema_b, 1,&_c->waiters_b_lock_,&_c->value_b);
-    if (r != 0)
+    if (!cv || n <= 0)
+      return EINVAL;
+    if (n > 16 && !(e = (cond_entry *) malloc(n * sizeof(*e))))
+      return ENOMEM;
+    for (i = 0; i < n; i++)
     {
-      ch->r[0] = r;
-      return;
+      if (!cv[i])
+      {
+	r = EINVAL;
+	goto out;
+      }
+      _c = (cond_t *) *cv[i];
+      if (STATIC_OR_NULL(_c))
+      {
+	r = cond_static_init(cv[i]);
+	if (r != 0 && r != EBUSY)
+	  goto out;
+	_c = (cond_t *) *cv[i];
+      }
+      if (PSHARED_P(_c) || _c->valid != (unsigned int)LIFE_COND
+	  || (i > 0 && _c->clock != e[0].c->clock))
+      {
+	r = EINVAL;
+	goto out;
+      }
+      for (j = 0; j < i; j++)
+      {
+	if (e[j].c == _c)
+	{
+	  r = EINVAL; /* the same condition variable twice */
+	  goto out;
+	}
+      }
+      e[i].c = _c;
     }
-  }
-  r = pthread_mutex_lock(ch->external_mutex);
-  if (r != 0)
-    ch->r[0] = r;
-}
-
-static int
-do_sema_b_wait (HANDLE sema, int nointerrupt, DWORD timeout,CRITICAL_SECTION *cs, LONG *val)
-{
-  int r;
-  LONG v;
-  EnterCriticalSection(cs);
-  InterlockedDecrement(val);
-  v = val[0];
-  LeaveCriticalSection(cs);
-  if (v >= 0)
-    return 0;
-  r = do_sema_b_wait_intern (sema, nointerrupt, timeout);
-  EnterCriticalSection(cs);
-  if (r != 0)
-    InterlockedIncrement(val);
-  LeaveCriticalSection(cs);
-  return r;
+    r = cond_wait_any(e, n, m, abstime, INFINITE, which);
+out:
+    if (e != e_stack)
+      free(e);
+    return r;
+#endif
 }
 
+/* Waits for sema.  Unless nointerrupt is 1, a cancellation request
+   sets the cancel event of the thread, which is waited for as well, so
+   blocked threads don't wake up to look for one.  Returns EINVAL when
+   canceled, after acting on it if nointerrupt is 0.  */
 int
 do_sema_b_wait_intern (HANDLE sema, int nointerrupt, DWORD timeout)
 {
   HANDLE arr[2];
-  DWORD maxH = 1;
+  DWORD maxH = 1, t0 = GetTickCount(), dt;
   int r = 0;
-  DWORD res, dt;
-  if (nointerrupt == 1)
-  {
-    res = WaitForSingleObject(sema, timeout);
-    switch (res) {
-    case WAIT_TIMEOUT:
-	r = ETIMEDOUT;
-	break;
-    case WAIT_ABANDONED:
-	r = EPERM;
-	break;
-    case WAIT_OBJECT_0:
-	break;
-    default:
-	/*We can only return EINVAL though it might not be posix compliant  */
-	r = EINVAL;
-    }
-    if (r != 0 && r != EINVAL && WaitForSingleObject(sema, 0) == WAIT_OBJECT_0)
-      r = 0;
-    return r;
-  }
+  DWORD res;
+
   arr[0] = sema;
-  arr[1] = pthread_self().p->evStart;
-  if (arr[1] != NULL) maxH += 1;
-  if (maxH == 2)
+  if (nointerrupt != 1 && (arr[1] = _pthread_get_cancel_event()) != NULL)
+    maxH = 2;
+  res = WaitForMultipleObjects(maxH, arr, 0, timeout);
+  /* A request which can't be acted on yet, with cancellation disabled
+     after it was set or in a _pthread_setnobreak section, stays
+     pending.  */
+  if (res == WAIT_OBJECT_0 + 1 && !__pthread_shallcancel ())
   {
-      res = WaitForMultipleObjects(maxH, arr, 0, timeout);
-      switch (res) {
-      case WAIT_TIMEOUT:
-	  r = ETIMEDOUT;
-	  break;
-      case (WAIT_OBJECT_0 + 1):
-          ResetEvent(arr[1]);
-          if (nointerrupt != 2)
-            pthread_testcancel();
-          return EINVAL;
-      case WAIT_ABANDONED:
-	  r = EPERM;
-	  break;
-      case WAIT_OBJECT_0:
-          r = 0;
-	  break;
-      default:
-	  /*We can only return EINVAL though it might not be posix compliant  */
-	  r = EINVAL;
-      }
-      if (r != 0 && r != EINVAL && WaitForSingleObject(arr[0], 0) == WAIT_OBJECT_0)
-	r = 0;
-      if (r != 0 && __pthread_shallcancel ())
-	return EINVAL;
-      return r;
+    if (timeout != INFINITE)
+      timeout = ((dt = GetTickCount() - t0) < timeout ? timeout - dt : 0);
+    res = WaitForSingleObject(sema, timeout);
   }
-  if (timeout == INFINITE)
-  {
-    do {
-      res = WaitForSingleObject(sema, 40);
-      switch (res) {
-      case WAIT_TIMEOUT:
-	  r = ETIMEDOUT;
-	  break;
-      case WAIT_ABANDONED:
-	  r = EPERM;
-	  break;
-      case WAIT_OBJECT_0:
-          r = 0;
-	  break;
-      default:
-	  /*We can only return EINVAL though it might not be posix compliant  */
-	  r = EINVAL;
-      }
-      if (r != 0 && __pthread_shallcancel ())
-      {
-	if (nointerrupt != 2)
-	  pthread_testcancel();
-	return EINVAL;
-      }
-    } while (r == ETIMEDOUT);
-    if (r != 0 && r != EINVAL && WaitForSingleObject(sema, 0) == WAIT_OBJECT_0)
+  switch (res) {
+  case WAIT_TIMEOUT:
+      r = ETIMEDOUT;
+      break;
+  case (WAIT_OBJECT_0 + 1):
+      ResetEvent(arr[1]);
+      if (nointerrupt != 2)
+	pthread_testcancel();
+      return EINVAL;
+  case WAIT_ABANDONED:
+      r = EPERM;
+      break;
+  case WAIT_OBJECT_0:
       r = 0;
-    return r;
+      break;
+  default:
+      /*We can only return EINVAL though it might not be posix compliant  */
+      r = EINVAL;
   }
-  dt = 20;
-  do {
-    if (dt > timeout) dt = timeout;
-    res = WaitForSingleObject(sema, dt);
-    switch (res) {
-    case WAIT_TIMEOUT:
-	r = ETIMEDOUT;
-	break;
-    case WAIT_ABANDONED:
-	r = EPERM;
-	break;
-    case WAIT_OBJECT_0:
-	r = 0;
-	break;
-    default:
-	/*We can only return EINVAL though it might not be posix compliant  */
-	r = EINVAL;
-    }
-    timeout -= dt;
-    if (timeout != 0 && r != 0 && __pthread_shallcancel ())
-      return EINVAL;
-  } while (r == ETIMEDOUT && timeout != 0);
-  if (r != 0 && r == ETIMEDOUT && WaitForSingleObject(sema, 0) == WAIT_OBJECT_0)
+  if (r != 0 && r != EINVAL && WaitForSingleObject(sema, 0) == WAIT_OBJECT_0)
     r = 0;
-  if (r != 0 && nointerrupt != 2)
-    pthread_testcancel();
+  if (r != 0 && maxH == 2 && __pthread_shallcancel ())
+    return EINVAL;
   return r;
 }
-
-static int
-do_sema_b_release(HANDLE sema, LONG count,CRITICAL_SECTION *cs, LONG *val)
-{
-  int wc;
-  EnterCriticalSection(cs);
-  if (((long long) val[0] + (long long) count) > (long long) 0x7fffffffLL)
-  {
-    LeaveCriticalSection(cs);
-    return ERANGE;
-  }
-  wc = -val[0];
-  InterlockedExchangeAdd(val, count);
-  if (wc <= 0 || ReleaseSemaphore(sema, (wc < count ? wc : count), NULL))
-  {
-    LeaveCriticalSection(cs);
-    return 0;
-  }
-  InterlockedExchangeAdd(val, -count);
-  LeaveCriticalSection(cs);
-  return EINVAL;  
-}
@@ -13,24 +13,70 @@
 
 #define STATIC_COND_INITIALIZER(x)		((pthread_cond_t)(x) == ((pthread_cond_t)PTHREAD_COND_INITIALIZER))
 
+/* pthread_condattr_t holds the process-shared flag in bit 0 and the
+   clock of timed waits above it.  */
+#define CONDATTR_PSHARED(a)	((a) & 1)
+#define CONDATTR_CLOCK(a)	((clockid_t) ((unsigned int) (a) >> 1))
+#define CONDATTR_MAKE(s, clk)	((s) | ((int) (clk) << 1))
+
+#if defined USE_COND_ConditionVariable
+/* The native condition variable works with any mutex: waiters hold
+   guard shared from before they unlock the mutex until they sleep, and
+   signals take it exclusively, so none slips in between.  */
+typedef struct cond_t cond_t;
+struct cond_t
+{
+    unsigned int valid;   
+    volatile LONG busy;	/* threads in pthread_cond_*wait */
+    volatile LONG waiters;	/* of them not signaled yet */
+    volatile LONG signals;	/* sent to them but not taken yet */
+    LONG seq;		/* of signals, tells waiters which came later */
+    clockid_t clock;	/* of timed waits */
+    CONDITION_VARIABLE cv;
+    SRWLOCK guard;
+};
+#else /* USE_COND_Queue */
+/* A waiter sleeps on the park event of its thread, see mutex_qnode,
+   which it shares with the mutex queues.  It is queued on each
+   condition variable it waits for by an entry.  q.state becomes
+   COND_W_SIGNALED when it has to lock the mutex itself, or
+   MUTEX_Q_GRANTED when it was requeued onto the mutex and got it handed
+   off.  Either a signal claims a queued waiter through one of its
+   entries, setting claim to COND_W_CLAIMED plus the index of the entry,
+   or the waiter gives up waiting, whoever first sets claim.  */
+#define COND_W_SIGNALED	3
+
+#define COND_W_GONE	1
+#define COND_W_CLAIMED	2
+
 typedef struct cond_t cond_t;
+typedef struct cond_waiter cond_waiter;
+typedef struct cond_entry cond_entry;
+
+struct cond_waiter
+{
+    mutex_qnode q;
+    volatile LONG claim;
+    pthread_mutex_t *m;
+};
+
+struct cond_entry
+{
+    cond_entry *next;
+    cond_waiter *w;
+    cond_t *c;
+    int index;
+};
+
 struct cond_t
 {
     unsigned int valid;   
-    int busy;
-    LONG waiters_count_; /* Number of waiting threads.  */
-    LONG waiters_count_unblock_; /* Number of waiting threads whitch can be unblocked.  */
-    LONG waiters_count_gone_; /* Number of waiters which are gone.  */
-    CRITICAL_SECTION waiters_count_lock_; /* Serialize access to <waiters_count_>.  */
-    CRITICAL_SECTION waiters_q_lock_; /* Serialize access to sema_q.  */
-    LONG value_q;
-    CRITICAL_SECTION waiters_b_lock_; /* Serialize access to sema_b.  */
-    LONG value_b;
-    HANDLE sema_q; /* Semaphore used to queue up threads waiting for the condition to
-                 become signaled.  */
-    HANDLE sema_b; /* Semaphore used to queue up threads waiting for the condition which
-                 became signaled.  */
+    int busy;		/* entries not claimed or left yet, guarded by qlock */
+    clockid_t clock;	/* of timed waits */
+    volatile LONG qlock;	/* guards the waiter queue */
+    cond_entry *qhead, *qtail;
 };
+#endif
 
 void cond_print_set(int state, FILE *f);
 
@@ -1,6 +1,51 @@
+#include <windows.h>
+#include <errno.h>
 #include "pthread.h"
 #include "misc.h"
 
+/* Number of processors usable by the process, cached at first use.  */
+int _pthread_num_cpus(void)
+{
+    static LONG ncpus = 0;
+    DWORD_PTR pm, sm;
+    LONG n = ncpus;
+
+    if (n)
+      return n;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &pm, &sm))
+    {
+      for (; pm != 0; pm &= pm - 1)
+        n++;
+    }
+    if (n < 1)
+      n = 1;
+    InterlockedExchange(&ncpus, n);
+    return n;
+}
+
+/* High resolution monotonic time, in ticks of the performance counter.  */
+unsigned long long _pthread_ticks(void)
+{
+    LARGE_INTEGER t;
+
+    QueryPerformanceCounter(&t);
+    return (unsigned long long) t.QuadPart;
+}
+
+unsigned long long _pthread_ticks_to_ns(unsigned long long t)
+{
+    static LONGLONG freq = 0;
+    LARGE_INTEGER f;
+
+    if (!freq)
+    {
+      QueryPerformanceFrequency(&f);
+      freq = f.QuadPart;
+    }
+    /* Split up, so that the multiplication doesn't overflow.  */
+    return (t / freq) * 1000000000ULL + (t % freq) * 1000000000ULL / freq;
+}
+
 unsigned long long _pthread_time_in_ms(void)
 {
     struct _timeb tb;
@@ -27,3 +72,106 @@ unsigned long long _pthread_rel_time_in_ms(const struct timespec *ts)
     return t1 - t2;
 }
 
+
+/* Milliseconds from now until ts on clock, rounded up, so that a wait
+   for them doesn't end before ts.  */
+unsigned long long _pthread_clock_rel_time_in_ms(clockid_t clock, const struct timespec *ts)
+{
+    struct timespec now;
+    long long dt;
+
+    if (clock_gettime(clock, &now) != 0)
+      return _pthread_rel_time_in_ms(ts);
+    dt = (long long) ts->tv_sec - (long long) now.tv_sec;
+    /* Too far off to matter, and too far to count in nanoseconds.  */
+    if (dt > 0xffffffffLL)
+      return (unsigned long long) dt * 1000ULL;
+    dt = dt * 1000000000LL + ((long long) ts->tv_nsec - now.tv_nsec);
+    if (dt <= 0)
+      return 0;
+    return ((unsigned long long) dt + 999999ULL) / 1000000ULL;
+}
+
+/* A relative timeout in milliseconds, rounded up.  */
+unsigned long long _pthread_rel_timespec_in_ms(const struct timespec *rel)
+{
+    if (rel->tv_sec < 0 || (rel->tv_sec == 0 && rel->tv_nsec <= 0))
+      return 0;
+    return (unsigned long long) rel->tv_sec * 1000ULL
+	   + ((unsigned long long) rel->tv_nsec + 999999ULL) / 1000000ULL;
+}
+
+/* The CLOCK_REALTIME time rel from now, for the waits which only take
+   absolute ones.  */
+void _pthread_abs_timespec(const struct timespec *rel, struct timespec *ts)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += rel->tv_sec;
+    ts->tv_nsec += rel->tv_nsec;
+    if (ts->tv_nsec >= 1000000000L)
+    {
+      ts->tv_sec++;
+      ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/* Windows counts the wall clock in 100 ns units since 1601.  */
+#define FILETIME_1970	116444736000000000ULL
+
+int clock_gettime(clockid_t clock_id, struct timespec *tp)
+{
+    unsigned long long t;
+    FILETIME ft;
+
+    if (!tp)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+    switch (clock_id)
+    {
+    case CLOCK_REALTIME:
+      GetSystemTimeAsFileTime(&ft);
+      t = (((unsigned long long) ft.dwHighDateTime << 32) | ft.dwLowDateTime) - FILETIME_1970;
+      tp->tv_sec = (time_t) (t / 10000000ULL);
+      tp->tv_nsec = (long) (t % 10000000ULL) * 100;
+      return 0;
+    case CLOCK_MONOTONIC:
+      t = _pthread_ticks_to_ns(_pthread_ticks());
+      tp->tv_sec = (time_t) (t / 1000000000ULL);
+      tp->tv_nsec = (long) (t % 1000000000ULL);
+      return 0;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+int clock_getres(clockid_t clock_id, struct timespec *res)
+{
+    DWORD adj, incr;
+    BOOL off;
+    unsigned long long ns;
+
+    switch (clock_id)
+    {
+    case CLOCK_REALTIME:
+      /* The wall clock advances once per timer interrupt.  */
+      if (!GetSystemTimeAdjustment(&adj, &incr, &off) || incr == 0)
+	incr = 156250;
+      ns = (unsigned long long) incr * 100ULL;
+      break;
+    case CLOCK_MONOTONIC:
+      if ((ns = _pthread_ticks_to_ns(1)) == 0)
+	ns = 1;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+    }
+    if (res)
+    {
+      res->tv_sec = (time_t) (ns / 1000000000ULL);
+      res->tv_nsec = (long) (ns % 1000000000ULL);
+    }
+    return 0;
+}
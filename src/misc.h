@@ -58,6 +58,10 @@ typedef long LONGBAG;
 
 #define VALID(x)    if (!(p)) return EINVAL;
 
+/* NULL or one of the GENERIC_*_INITIALIZER values (-1 .. -3), tested
+   with a single unsigned compare on the fast paths.  */
+#define STATIC_OR_NULL(x)	((uintptr_t)(x) + 3 <= 3)
+
 /* ms can be 64 bit, solve wrap-around issues: */
 #define dwMilliSecs(ms)		((ms) >= INFINITE ? INFINITE : (DWORD)(ms))
 
@@ -73,8 +77,14 @@ typedef long LONGBAG;
 #define YieldProcessor      _mm_pause
 #endif
 
+int _pthread_num_cpus(void);
+unsigned long long _pthread_ticks(void);
+unsigned long long _pthread_ticks_to_ns(unsigned long long t);
 unsigned long long _pthread_time_in_ms(void);
 unsigned long long _pthread_time_in_ms_from_timespec(const struct timespec *ts);
 unsigned long long _pthread_rel_time_in_ms(const struct timespec *ts);
+unsigned long long _pthread_clock_rel_time_in_ms(clockid_t clock, const struct timespec *ts);
+unsigned long long _pthread_rel_timespec_in_ms(const struct timespec *rel);
+void _pthread_abs_timespec(const struct timespec *rel, struct timespec *ts);
 
 #endif
@@ -5,124 +5,372 @@
 #include "spinlock.h"
 #include "ref.h"
 #include "mutex.h"
+#include "thread.h"
 #include "misc.h"
+#include "pshared.h"
 
 extern int do_sema_b_wait_intern (HANDLE sema, int nointerrupt, DWORD timeout);
-static __attribute__((noinline)) int mutex_static_init(pthread_mutex_t *m);
 static __attribute__((noinline)) int _mutex_trylock(pthread_mutex_t *m);
+static int _mutex_lock(pthread_mutex_t *m, DWORD timeout);
+static int _mutex_unlock(pthread_mutex_t *m);
 
-static spin_t mutex_global = {0,LIFE_SPINLOCK,0};
-static spin_t mutex_global_static = {0,LIFE_SPINLOCK,0};
+#ifdef USE_MUTEX_InPlace
+/* The public storage must be able to hold the mutex.  */
+typedef char mutex_inplace_size_check[(sizeof(mutex_t) <= sizeof(pthread_mutex_t)) ? 1 : -1];
+#else
+static __attribute__((noinline)) int mutex_static_init(pthread_mutex_t *m);
+#endif
 
-static __attribute__((noinline)) int
-mutex_unref(pthread_mutex_t *m, int r)
-{
-    mutex_t *m_ = (mutex_t *)*m;
-    _spin_lite_lock(&mutex_global);
-#ifdef WINPTHREAD_DBG
-    assert((m_->valid == LIFE_MUTEX) && (m_->busy > 0));
+/* There is no process-wide lock on the lock/unlock paths.  Owning the
+   lock word protects a mutex against destruction.  Threads that touch
+   a mutex without owning it (blocked waiters, and the unlock path while
+   it wakes them) count themselves in the per-object busy counter.
+   A busy mutex can't be destroyed.  */
+#define mutex_busy(m_)		InterlockedIncrement(&(m_)->busy)
+#define mutex_unbusy(m_)	InterlockedDecrement(&(m_)->busy)
+
+#if defined USE_MUTEX_Mutex
+static int mutex_fifo_handoff(mutex_t *_m);
 #endif
-    m_->busy --;
-    _spin_lite_unlock(&mutex_global);
-    return r;
-}
 
-/* Set the mutex to busy in a thread-safe way */
-/* A busy mutex can't be destroyed */
-static __attribute__((noinline)) int
-mutex_ref(pthread_mutex_t *m )
+/* Short-term lock of the mutex bookkeeping, never held while blocking.  */
+static void
+mutex_qlock(mutex_t *_m)
 {
-    int r = 0;
-
-    _spin_lite_lock(&mutex_global);
-    if (!m || !*m)
+    while (InterlockedExchange(&_m->qlock, 1) != 0)
     {
-      _spin_lite_unlock(&mutex_global);
-      return EINVAL;
+      while (_m->qlock != 0)
+	YieldProcessor();
     }
-    if (STATIC_INITIALIZER(*m))
+}
+
+#define mutex_qunlock(m_)	InterlockedExchange(&(m_)->qlock, 0)
+
+/* PTHREAD_PRIO_INHERIT and PTHREAD_PRIO_PROTECT: the owner runs at least
+   at the priority of its waiters, or the ceiling of the mutex.  It gets
+   back its own priority, sched.sched_priority, when it has released all
+   such mutexes.  Boosts aren't passed on along chains of owners.  */
+
+/* Priority the calling thread runs at right now.  */
+static int
+mutex_prio_self(struct _pthread_v *t)
+{
+    return (t->pi_locks != 0 ? t->pi_prio : t->sched.sched_priority);
+}
+
+/* Detached threads don't keep their handle in h, so the owner opens
+   hprio for the others when it first locks such a mutex.  */
+static void
+mutex_prio_set(struct _pthread_v *t, int prio)
+{
+    if (t == pthread_self().p)
+      SetThreadPriority(GetCurrentThread(), prio);
+    else if (t->hprio != NULL)
+      SetThreadPriority(t->hprio, prio);
+}
+
+static void
+mutex_prio_raise(struct _pthread_v *t, int prio)
+{
+    LONG p;
+
+    while ((p = t->pi_prio) < prio)
     {
-      _spin_lite_unlock(&mutex_global);
-      r = mutex_static_init(m);
-      _spin_lite_lock(&mutex_global);
-      if (r != 0 && r != EBUSY)
+      if (InterlockedCompareExchange(&t->pi_prio, prio, p) == p)
       {
-	_spin_lite_unlock(&mutex_global);
-	return r;
+	mutex_prio_set(t, prio);
+	break;
       }
     }
-    r = 0;
-    if (!m || !*m || ((mutex_t *)*m)->valid != LIFE_MUTEX) r = EINVAL;
-    else {
-        ((mutex_t *)*m)->busy ++;
-    }
+}
 
-    _spin_lite_unlock(&mutex_global);
+/* A PTHREAD_PRIO_INHERIT waiter passes its priority on to the owner.
+   qlock keeps the owner from releasing the mutex meanwhile.  */
+static void
+mutex_prio_inherit(mutex_t *_m)
+{
+    struct _pthread_v *t = pthread_self().p;
+
+    if (!t)
+      return;
+    mutex_qlock(_m);
+    if (_m->powner != NULL)
+      mutex_prio_raise(_m->powner, mutex_prio_self(t));
+    mutex_qunlock(_m);
+}
 
-    return r;
+static void
+mutex_prio_locked(mutex_t *_m)
+{
+    struct _pthread_v *t = pthread_self().p;
+
+    if (!t)
+      return;
+    if (t->hprio == NULL)
+      DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(),
+		      &t->hprio, THREAD_SET_INFORMATION, FALSE, 0);
+    if (InterlockedIncrement(&t->pi_locks) == 1)
+      t->pi_prio = t->sched.sched_priority;
+    if (_m->protocol == PTHREAD_PRIO_PROTECT)
+      mutex_prio_raise(t, _m->prioceiling);
+    mutex_qlock(_m);
+    _m->powner = t;
+    mutex_qunlock(_m);
 }
 
-/* An unlock can simply fail with EPERM instead of auto-init (can't be owned) */
-static __attribute__((noinline)) int
-mutex_ref_unlock(pthread_mutex_t *m)
+/* Called before the mutex is released, returns the former owner.  */
+static struct _pthread_v *
+mutex_prio_disown(mutex_t *_m)
 {
-    int r = 0;
-    mutex_t *m_ = (mutex_t *)*m;
+    struct _pthread_v *t;
 
-    _spin_lite_lock(&mutex_global);
+    mutex_qlock(_m);
+    t = _m->powner;
+    _m->powner = NULL;
+    mutex_qunlock(_m);
+    return t;
+}
 
-    if (!m || !*m || ((mutex_t *)*m)->valid != LIFE_MUTEX) r = EINVAL;
-    else if (STATIC_INITIALIZER(*m) || !COND_LOCKED(m_)) {
-      r= EPERM;
+/* Called after the mutex is released, so the owner doesn't lose the
+   boost while it still holds the mutex.  */
+static void
+mutex_prio_restore(struct _pthread_v *t)
+{
+    if (t != NULL && InterlockedDecrement(&t->pi_locks) == 0
+	&& t->pi_prio != t->sched.sched_priority)
+    {
+      t->pi_prio = t->sched.sched_priority;
+      mutex_prio_set(t, t->sched.sched_priority);
     }
-    else {
-        ((mutex_t *)*m)->busy ++;
+}
+
+/* A PTHREAD_PRIO_PROTECT mutex can't be locked from above its ceiling.  */
+static int
+mutex_prio_check(mutex_t *_m)
+{
+    struct _pthread_v *t;
+
+    if (_m->protocol != PTHREAD_PRIO_PROTECT || (t = pthread_self().p) == NULL)
+      return 0;
+    return (t->sched.sched_priority > _m->prioceiling ? EINVAL : 0);
+}
+
+/* Contention statistics, see pthread_mutex_setstats_np.  While they are
+   off, the lock paths just test mutex_stats_on.  The inline fast paths
+   test it as well, so they are back once statistics are turned off.  */
+volatile LONG _pthread_mutex_stats_on = 0;
+#define mutex_stats_on		_pthread_mutex_stats_on
+static spin_t mutex_stats_lock = SPIN_LITE_INITIALIZER(NULL);
+static mutex_stats *mutex_stats_list = NULL;
+
+/* Returns the statistics of the mutex, attaching them at first use.  */
+static __attribute__((noinline)) mutex_stats *
+mutex_stats_ref(pthread_mutex_t *m, mutex_t *_m)
+{
+    mutex_stats *st = _m->stats;
+
+    if (st != NULL)
+      return st;
+    if ((st = (mutex_stats *) calloc(1, sizeof(*st))) == NULL)
+      return NULL;
+    st->m = m;
+    if (InterlockedCompareExchangePointer((void **) &_m->stats, st, NULL) != NULL)
+    {
+      /* someone sneaked in between, keep the original: */
+      free(st);
+      return _m->stats;
     }
+    _spin_lite_lock(&mutex_stats_lock);
+    if ((st->next = mutex_stats_list) != NULL)
+      st->next->prev = st;
+    mutex_stats_list = st;
+    _spin_lite_unlock(&mutex_stats_lock);
+    return st;
+}
+
+static void
+mutex_stats_detach(mutex_t *_m)
+{
+    mutex_stats *st = _m->stats;
+
+    if (st == NULL)
+      return;
+    _m->stats = NULL;
+    _spin_lite_lock(&mutex_stats_lock);
+    if (st->prev)
+      st->prev->next = st->next;
+    else
+      mutex_stats_list = st->next;
+    if (st->next)
+      st->next->prev = st->prev;
+    _spin_lite_unlock(&mutex_stats_lock);
+    free(st);
+}
 
-    _spin_lite_unlock(&mutex_global);
+/* The calling thread has to wait for the mutex, returns the start time.  */
+static unsigned long long
+mutex_stats_wait(mutex_stats *st)
+{
+    InterlockedIncrement(&st->s.waiters);
+    return _pthread_ticks();
+}
 
-    return r;
+static void
+mutex_stats_waited(mutex_stats *st, unsigned long long t, int r)
+{
+    InterlockedDecrement(&st->s.waiters);
+    if (r != 0)
+      return;
+    t = _pthread_ticks() - t;
+    st->s.contended++;
+    st->s.wait_time += t;
+    if (t > st->s.wait_time_max)
+      st->s.wait_time_max = t;
 }
 
-/* doesn't lock the mutex but set it to invalid in a thread-safe way */
-/* A busy mutex can't be destroyed -> EBUSY */
-static __attribute__((noinline)) int
-mutex_ref_destroy(pthread_mutex_t *m, pthread_mutex_t *mDestroy )
+static void
+mutex_stats_locked(mutex_stats *st)
 {
-    int r = 0;
+    st->s.acquisitions++;
+    st->t_locked = _pthread_ticks();
+}
 
-    *mDestroy = NULL;
-    /* also considered as busy, any concurrent access prevents destruction: */
-    if (_spin_lite_trylock(&mutex_global)) return EBUSY;
-    
-    if (!m || !*m) r = EINVAL;
-    else {
-        mutex_t *m_ = (mutex_t *)*m;
-        if (STATIC_INITIALIZER(*m)) *m = NULL;
-        else if (m_->valid != LIFE_MUTEX) r = EINVAL;
-        else if (m_->busy || COND_LOCKED(m_)) r = EBUSY;
-        else {
-            *mDestroy = *m;
-            *m = NULL;
-        }
+static void
+mutex_stats_unlocked(mutex_stats *st)
+{
+    if (st->t_locked == 0)
+      return; /* locked while the statistics were off */
+    st->s.hold_time += _pthread_ticks() - st->t_locked;
+    st->t_locked = 0;
+}
+
+/* Checks the mutex and does the initialization of static initializers */
+static int
+mutex_ref(pthread_mutex_t *m)
+{
+#ifdef USE_MUTEX_InPlace
+    if (!m || MUTEX_PTR(m)->valid != LIFE_MUTEX)
+      return EINVAL;
+    return 0;
+#else
+    int r;
+
+    if (!m)
+      return EINVAL;
+    if (STATIC_OR_NULL(*m))
+    {
+      if ((r = mutex_static_init(m)) != 0)
+	return r;
+      if (STATIC_OR_NULL(*m))
+	return EINVAL;
     }
+    /* Process-shared ones only get here when not supported.  */
+    if (PSHARED_P(*m) || ((mutex_t *)*m)->valid != LIFE_MUTEX)
+      return EINVAL;
+    return 0;
+#endif
+}
 
-    _spin_lite_unlock(&mutex_global);
-    return r;
+/* An unlock can simply fail with EPERM instead of auto-init (can't be owned) */
+static int
+mutex_ref_unlock(pthread_mutex_t *m)
+{
+#ifdef USE_MUTEX_InPlace
+    if (!m)
+      return EINVAL;
+#else
+    if (!m)
+      return EINVAL;
+    if (STATIC_OR_NULL(*m))
+      return (*m != NULL ? EPERM : EINVAL);
+#endif
+    if (MUTEX_PTR(m)->valid != LIFE_MUTEX)
+      return EINVAL;
+    if (!COND_LOCKED(MUTEX_PTR(m)))
+      return EPERM;
+    return 0;
 }
 
-static __attribute__((noinline)) int mutex_ref_init(pthread_mutex_t *m )
+/* Takes the lock word of the mutex without any type semantics.  */
+static int
+mutex_raw_trylock(mutex_t *_m)
+{
+#if defined USE_MUTEX_Mutex
+    return (InterlockedCompareExchange(&_m->state, MUTEX_LOCKED, MUTEX_UNLOCKED) == MUTEX_UNLOCKED) ? 0 : EBUSY;
+#else /* USE_MUTEX_CriticalSection */
+    if (COND_LOCKED(_m))
+      return EBUSY;
+    return TryEnterCriticalSection(&_m->cs.cs) ? 0 : EBUSY;
+#endif
+}
+
+/* Releases the lock word, waking up a waiter if there is one.  */
+static int
+mutex_raw_unlock(mutex_t *_m)
 {
     int r = 0;
 
-    _spin_lite_lock(&mutex_global);
-    
-    if (!m)  r = EINVAL;
- 
-    _spin_lite_unlock(&mutex_global);
+#if defined USE_MUTEX_Mutex
+    /* Uncontended: nobody else can look at the mutex anymore.  */
+    if (InterlockedCompareExchange(&_m->state, MUTEX_UNLOCKED, MUTEX_LOCKED) == MUTEX_LOCKED)
+      return 0;
+    /* Waiters need the semaphore, so keep the mutex busy meanwhile.  */
+    mutex_busy(_m);
+    r = mutex_fifo_handoff(_m);
+    mutex_unbusy(_m);
+#else /* USE_MUTEX_CriticalSection */
+    mutex_busy(_m);
+    LeaveCriticalSection(&_m->cs.cs);
+    if (_m->waiters != 0)
+      SetEvent(_m->h);
+    mutex_unbusy(_m);
+#endif
     return r;
 }
 
+/* doesn't lock the mutex but set it to invalid in a thread-safe way */
+/* A busy mutex can't be destroyed -> EBUSY */
+static int
+mutex_ref_destroy(pthread_mutex_t *m, mutex_t **mDestroy )
+{
+    mutex_t *m_;
+
+    *mDestroy = NULL;
+#ifdef USE_MUTEX_InPlace
+    if (!m)
+      return EINVAL;
+    m_ = MUTEX_PTR(m);
+#else
+    if (!m || !*m)
+      return EINVAL;
+    m_ = (mutex_t *)*m;
+    if (STATIC_INITIALIZER(m_))
+    {
+      /* Fails if someone initializes it concurrently.  */
+      if (InterlockedCompareExchangePointer(m, NULL, m_) != m_)
+	return EBUSY;
+      return 0;
+    }
+#endif
+    if (m_->valid != LIFE_MUTEX)
+      return EINVAL;
+    /* Owning the lock keeps new lockers out, busy counts the waiters.  */
+    if (mutex_raw_trylock(m_) != 0)
+      return EBUSY;
+    if (m_->busy != 0)
+    {
+      mutex_raw_unlock(m_);
+      return EBUSY;
+    }
+    *mDestroy = m_;
+#ifdef USE_MUTEX_InPlace
+    m_->valid = DEAD_MUTEX;
+#else
+    *m = NULL;
+#endif
+    return 0;
+}
+
 #ifdef WINPTHREAD_DBG
 static int print_state = 1;
 
@@ -134,12 +382,12 @@ void mutex_print_set(int state)
 void mutex_print(pthread_mutex_t *m, char *txt)
 {
     if (!print_state) return;
-    mutex_t *m_ = (mutex_t *)*m;
+    mutex_t *m_ = MUTEX_PTR(m);
     if (m_ == NULL) {
-        printf("M%p %d %s\n",*m,(int)GetCurrentThreadId(),txt);
+        printf("M%p %d %s\n",m_,(int)GetCurrentThreadId(),txt);
     } else {
         printf("M%p %d V=%0X B=%d t=%d o=%d C=%d R=%d H=%p %s\n",
-            *m, 
+            m_, 
             (int)GetCurrentThreadId(), 
             (int)m_->valid, 
             (int)m_->busy,
@@ -149,34 +397,333 @@ void mutex_print(pthread_mutex_t *m, char *txt)
 }
 #endif
 
+#ifndef USE_MUTEX_InPlace
+/* Initializes the mutex privately and publishes it with a single
+   compare-and-swap over the static initializer.  The loser of a race
+   frees its copy.  */
 static __attribute__((noinline)) int
 mutex_static_init(pthread_mutex_t *m)
 {
     static pthread_mutexattr_t mxattr_recursive = PTHREAD_MUTEX_RECURSIVE;
     static pthread_mutexattr_t mxattr_errorcheck = PTHREAD_MUTEX_ERRORCHECK;
+    pthread_mutex_t si = *m, nm = NULL;
+    int r;
+
+    if (si == NULL)
+      return EINVAL;
+    if (!STATIC_INITIALIZER(si))
+      return 0; /* Assume someone crept in between.  */
+    if (si == PTHREAD_RECURSIVE_MUTEX_INITIALIZER)
+      r = pthread_mutex_init (&nm, &mxattr_recursive);
+    else if (si == PTHREAD_ERRORCHECK_MUTEX_INITIALIZER)
+      r = pthread_mutex_init (&nm, &mxattr_errorcheck);
+    else
+      r = pthread_mutex_init (&nm, NULL);
+    if (r != 0)
+      return r;
+    if (InterlockedCompareExchangePointer(m, nm, si) != si)
+      pthread_mutex_destroy (&nm);
+    return 0;
+}
+#endif
+
+/* Returns the wait handle of the mutex.  It is only created the first
+   time a thread actually has to block on the mutex.  USE_MUTEX_Mutex
+   waits on a semaphore, timed waiters of a critical section on an
+   auto-reset event.  */
+static HANDLE
+mutex_get_handle(mutex_t *_m)
+{
+    HANDLE h = _m->h;
+
+    if (h != NULL)
+      return h;
+#if defined USE_MUTEX_Mutex
+    h = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+#else /* USE_MUTEX_CriticalSection */
+    h = CreateEvent(NULL, FALSE, FALSE, NULL);
+#endif
+    if (h == NULL)
+      return NULL;
+    if (InterlockedCompareExchangePointer(&_m->h, h, NULL) != NULL)
+    {
+      /* someone sneaked in between, keep the original: */
+      CloseHandle(h);
+      h = _m->h;
+    }
+    return h;
+}
+
+#if !defined USE_MUTEX_Mutex
+/* A critical section can't be waited for with a timeout.  Timed waiters
+   register in waiters and sleep on the event instead, which unlocking
+   sets while there are any.  A wakeup that comes too early or goes to
+   the wrong waiter just means another round of trying.  */
+static int
+mutex_lock_cs(mutex_t *_m, DWORD timeout)
+{
+    unsigned long long t_end, ct;
+    HANDLE h;
+    int r = 0;
+
+    if (timeout == INFINITE)
+    {
+      EnterCriticalSection(&_m->cs.cs);
+      return 0;
+    }
+    if (TryEnterCriticalSection(&_m->cs.cs))
+      return 0;
+    if ((h = mutex_get_handle(_m)) == NULL)
+      return ENOMEM;
+    t_end = _pthread_time_in_ms() + timeout;
+    InterlockedIncrement(&_m->waiters);
+    /* Registered before trying again, so an unlock can't slip through.  */
+    while (!TryEnterCriticalSection(&_m->cs.cs))
+    {
+      ct = _pthread_time_in_ms();
+      if (ct >= t_end)
+      {
+	r = ETIMEDOUT;
+	break;
+      }
+      WaitForSingleObject(h, dwMilliSecs(t_end - ct));
+    }
+    InterlockedDecrement(&_m->waiters);
+    return r;
+}
+#endif
 
+#if defined USE_MUTEX_Mutex
+/* PTHREAD_MUTEX_ADAPTIVE_NP: spin on the lock word before blocking, as
+   the owner is likely running on another processor.  The budget is an
+   exponential average of the spins needed by earlier acquisitions.  */
+static int
+mutex_spin_adaptive(mutex_t *_m)
+{
+    LONG cnt = 0, max_cnt;
+
+    if (_pthread_num_cpus() < 2)
+      return EBUSY;
+    max_cnt = _m->spins * 2 + 10;
+    if (max_cnt > USE_MUTEX_AdaptiveSpinMax)
+      max_cnt = USE_MUTEX_AdaptiveSpinMax;
+    do {
+      if (cnt++ >= max_cnt)
+      {
+	_m->spins += (cnt - _m->spins) / 8;
+	return EBUSY;
+      }
+      YieldProcessor();
+    } while (_m->state != MUTEX_UNLOCKED
+	     || InterlockedCompareExchange(&_m->state, MUTEX_LOCKED, MUTEX_UNLOCKED) != MUTEX_UNLOCKED);
+    _m->spins += (cnt - _m->spins) / 8;
+    return 0;
+}
+
+/* Contended path: mark the lock word as contended and sleep on the
+   semaphore until the exchange finds the mutex unlocked.  */
+static int
+mutex_lock_slow(mutex_t *_m, DWORD timeout)
+{
+    unsigned long long t_end = 0, ct;
+    HANDLE h;
     int r;
 
-    _spin_lite_lock(&mutex_global_static);
-    if (!STATIC_INITIALIZER(*m)) {
-        /* Assume someone crept in between: */
-        r = 0;
+    if ((h = mutex_get_handle(_m)) == NULL)
+      return ENOMEM;
+    if (timeout != INFINITE)
+      t_end = _pthread_time_in_ms() + timeout;
+    while (InterlockedExchange(&_m->state, MUTEX_CONTENDED) != MUTEX_UNLOCKED)
+    {
+      r = do_sema_b_wait_intern (h, 1, timeout);
+      if (r != 0)
+	return r;
+      if (timeout != INFINITE)
+      {
+	ct = _pthread_time_in_ms();
+	timeout = (ct >= t_end ? 0 : dwMilliSecs(t_end - ct));
+      }
     }
-    else
+    return 0;
+}
+
+/* PTHREAD_MUTEX_POLICY_FIFO_NP: waiters queue up in arrival order and
+   the unlocking thread hands the mutex directly to the first of them,
+   so the lock word stays locked and nobody can overtake the queue.
+   The lock word is MUTEX_CONTENDED as long as the queue isn't empty.
+   qlock guards the queue.  */
+
+/* Wakes up the first waiter, and makes it the owner.  A parked waiter
+   doesn't return before it got the event, so ev stays valid.  Mutexes
+   of the default policy only have queued waiters requeued by a
+   condition variable, and otherwise wake a waiter on the semaphore.
+   Those might still sleep after the queue ran empty, so the lock word
+   stays contended.  */
+static int
+mutex_fifo_handoff(mutex_t *_m)
+{
+    mutex_qnode *q;
+    HANDLE ev = NULL;
+    int fifo = (_m->policy == PTHREAD_MUTEX_POLICY_FIFO_NP), sema = 0;
+
+    mutex_qlock(_m);
+    if ((q = _m->qhead) == NULL)
     {
-      if (*m == PTHREAD_MUTEX_INITIALIZER)
-	r = pthread_mutex_init (m, NULL);
-      else if (*m == PTHREAD_RECURSIVE_MUTEX_INITIALIZER)
-	r = pthread_mutex_init (m, &mxattr_recursive);
-      else if (*m == PTHREAD_ERRORCHECK_MUTEX_INITIALIZER)
-	r = pthread_mutex_init (m, &mxattr_errorcheck);
-      else if (*m == NULL)
-	r = EINVAL;
+      if (fifo)
+	_m->state = MUTEX_UNLOCKED;
       else
-	r = pthread_mutex_init(m, NULL);
+	sema = (InterlockedExchange(&_m->state, MUTEX_UNLOCKED) == MUTEX_CONTENDED);
     }
-    _spin_lite_unlock(&mutex_global_static);
-    return r;
+    else
+    {
+      if ((_m->qhead = q->next) == NULL)
+      {
+	_m->qtail = NULL;
+	if (fifo)
+	  _m->state = MUTEX_LOCKED;
+      }
+      ev = q->ev;
+      if (InterlockedExchange(&q->state, MUTEX_Q_GRANTED) != MUTEX_Q_PARKED)
+	ev = NULL;
+    }
+    mutex_qunlock(_m);
+    if (ev != NULL)
+      SetEvent(ev);
+    if (sema && !ReleaseSemaphore(_m->h, 1, NULL))
+      return EPERM;
+    return 0;
+}
+
+/* Queues the calling thread and waits for the handoff.  It spins on its
+   own node for a while before it parks on its event.  */
+static int
+mutex_lock_fifo(mutex_t *_m, DWORD timeout)
+{
+    mutex_qnode q;
+    LONG s, cnt;
+    DWORD res;
+
+    if ((q.ev = _pthread_get_park_event()) == NULL)
+      return ENOMEM;
+    q.next = NULL;
+    q.state = MUTEX_Q_WAITING;
+
+    mutex_qlock(_m);
+    for (;;)
+    {
+      s = _m->state;
+      if (s == MUTEX_UNLOCKED)
+      {
+	if (InterlockedCompareExchange(&_m->state, MUTEX_LOCKED, MUTEX_UNLOCKED) == MUTEX_UNLOCKED)
+	{
+	  mutex_qunlock(_m);
+	  return 0;
+	}
+      }
+      else if (InterlockedCompareExchange(&_m->state, MUTEX_CONTENDED, s) == s)
+	break;
+    }
+    if (_m->qtail)
+      _m->qtail->next = &q;
+    else
+      _m->qhead = &q;
+    _m->qtail = &q;
+    mutex_qunlock(_m);
+
+    if (_pthread_num_cpus() > 1 && timeout != 0)
+    {
+      for (cnt = 0; cnt < USE_MUTEX_FifoSpinCount && q.state == MUTEX_Q_WAITING; cnt++)
+	YieldProcessor();
+    }
+    if (InterlockedCompareExchange(&q.state, MUTEX_Q_PARKED, MUTEX_Q_WAITING) != MUTEX_Q_WAITING)
+      return 0;
+    res = WaitForSingleObject(q.ev, timeout);
+    if (res == WAIT_OBJECT_0)
+      return 0;
+
+    mutex_qlock(_m);
+    if (q.state == MUTEX_Q_GRANTED)
+    {
+      /* Granted meanwhile: the event is set right after, consume it.  */
+      mutex_qunlock(_m);
+      WaitForSingleObject(q.ev, INFINITE);
+      return 0;
+    }
+    if (_m->qhead == &q)
+    {
+      if ((_m->qhead = q.next) == NULL)
+	_m->qtail = NULL;
+    }
+    else
+    {
+      mutex_qnode *p = _m->qhead;
+      while (p->next != &q)
+	p = p->next;
+      if ((p->next = q.next) == NULL)
+	_m->qtail = p;
+    }
+    if (_m->qhead == NULL)
+      _m->state = MUTEX_LOCKED;
+    mutex_qunlock(_m);
+    return (res == WAIT_TIMEOUT ? ETIMEDOUT : EINVAL);
+}
+#endif
+
+/* Wait morphing: queues q of a thread waiting on a condition variable
+   for the handoff of the locked mutex m, instead of waking it up only
+   to block on m.  Returns EBUSY if m is unlocked, or some other error
+   if it can't take queued waiters; the caller wakes the thread then.
+   The thread calls _mutex_granted once q is MUTEX_Q_GRANTED.  */
+int
+_mutex_requeue(pthread_mutex_t *m, mutex_qnode *q)
+{
+#if defined USE_MUTEX_Mutex
+    mutex_t *_m;
+    LONG s;
+
+    if (MUTEX_PSHARED(m) || mutex_ref(m) != 0)
+      return EINVAL;
+    _m = MUTEX_PTR(m);
+    /* A recursive mutex might still be held by the waiter itself.  */
+    if (_m->type == PTHREAD_MUTEX_RECURSIVE || _m->protocol != PTHREAD_PRIO_NONE)
+      return EINVAL;
+    /* Once the queue ran empty, an unlock wakes the semaphore.  */
+    if (mutex_get_handle(_m) == NULL)
+      return ENOMEM;
+    mutex_qlock(_m);
+    do {
+      if ((s = _m->state) == MUTEX_UNLOCKED)
+      {
+	mutex_qunlock(_m);
+	return EBUSY;
+      }
+    } while (InterlockedCompareExchange(&_m->state, MUTEX_CONTENDED, s) != s);
+    q->next = NULL;
+    if (_m->qtail)
+      _m->qtail->next = q;
+    else
+      _m->qhead = q;
+    _m->qtail = q;
+    mutex_busy(_m);
+    mutex_qunlock(_m);
+    return 0;
+#else
+    return ENOTSUP;
+#endif
+}
+
+/* Takes over the mutex handed off to a requeued waiter.  */
+void
+_mutex_granted(pthread_mutex_t *m)
+{
+    mutex_t *_m = MUTEX_PTR(m);
+    mutex_stats *st;
+
+    mutex_unbusy(_m);
+    _m->count = 1;
+    SET_OWNER(_m);
+    if (mutex_stats_on && (st = mutex_stats_ref(m, _m)) != NULL)
+      mutex_stats_locked(st);
 }
 
 static int pthread_mutex_lock_intern(pthread_mutex_t *m, DWORD timeout);
@@ -188,13 +735,27 @@ int pthread_mutex_lock(pthread_mutex_t *m)
 
 static int pthread_mutex_lock_intern(pthread_mutex_t *m, DWORD timeout)
 {
-    mutex_t *_m;
     int r;
+
+    if (MUTEX_PSHARED(m))
+      return _pshared_mutex_lock(m, NULL);
     r = mutex_ref(m);
     if(r) return r;
 
-    _m = (mutex_t *)*m;
-    if (_m->type != PTHREAD_MUTEX_NORMAL)
+    return _mutex_lock(m, timeout);
+}
+
+/* Locks a mutex which passed mutex_ref already.  */
+static int
+_mutex_lock(pthread_mutex_t *m, DWORD timeout)
+{
+    mutex_t *_m;
+    mutex_stats *st;
+    unsigned long long t = 0;
+    int r;
+
+    _m = MUTEX_PTR(m);
+    if (!COND_NORMAL(_m))
     {
       if (COND_LOCKED(_m))
       {
@@ -202,10 +763,13 @@ static int pthread_mutex_lock_intern(pthread_mutex_t *m, DWORD timeout)
 	{
 	  if (_m->type == PTHREAD_MUTEX_RECURSIVE)
 	  {
-	    InterlockedIncrement(&_m->count);
-	    return mutex_unref(m,0);
+	    /* Only the owner gets here, no need for atomics.  */
+	    if (_m->count == LONG_MAX)
+	      return EAGAIN;
+	    _m->count++;
+	    return 0;
 	  }
-	  return mutex_unref(m, EDEADLK);
+	  return EDEADLK;
 	}
       }
     } else {
@@ -218,18 +782,62 @@ static int pthread_mutex_lock_intern(pthread_mutex_t *m, DWORD timeout)
       }
 #endif
     }
+    if (_m->protocol != PTHREAD_PRIO_NONE && (r = mutex_prio_check(_m)) != 0)
+      return r;
+    st = (mutex_stats_on ? mutex_stats_ref(m, _m) : NULL);
 #if defined USE_MUTEX_Mutex
-    r = do_sema_b_wait_intern (_m->h, 1, timeout);
+    if (InterlockedCompareExchange(&_m->state, MUTEX_LOCKED, MUTEX_UNLOCKED) == MUTEX_UNLOCKED)
+      r = 0;
+    else
+    {
+      if (st)
+	t = mutex_stats_wait(st);
+      if (_m->protocol == PTHREAD_PRIO_INHERIT)
+	mutex_prio_inherit(_m);
+      if (_m->policy == PTHREAD_MUTEX_POLICY_FIFO_NP)
+      {
+	mutex_busy(_m);
+	r = mutex_lock_fifo(_m, timeout);
+	mutex_unbusy(_m);
+      }
+      else if (_m->type == PTHREAD_MUTEX_ADAPTIVE_NP && !mutex_spin_adaptive(_m))
+	r = 0;
+      else
+      {
+	mutex_busy(_m);
+	r = mutex_lock_slow(_m, timeout);
+	mutex_unbusy(_m);
+      }
+      if (st)
+	mutex_stats_waited(st, t, r);
+    }
 #else /* USE_MUTEX_CriticalSection */
-    EnterCriticalSection(&_m->cs.cs);
-    r = 0;
+    /* Only try first if someone needs to know about contention.  */
+    if ((st || _m->protocol == PTHREAD_PRIO_INHERIT) && TryEnterCriticalSection(&_m->cs.cs))
+      r = 0;
+    else
+    {
+      if (st)
+	t = mutex_stats_wait(st);
+      if (_m->protocol == PTHREAD_PRIO_INHERIT)
+	mutex_prio_inherit(_m);
+      mutex_busy(_m);
+      r = mutex_lock_cs(_m, timeout);
+      mutex_unbusy(_m);
+      if (st)
+	mutex_stats_waited(st, t, r);
+    }
 #endif
     if (r == 0)
     {
       _m->count = 1;
       SET_OWNER(_m);
+      if (st)
+	mutex_stats_locked(st);
+      if (_m->protocol != PTHREAD_PRIO_NONE)
+	mutex_prio_locked(_m);
     }
-    return mutex_unref(m,r);
+    return r;
 
 }
 
@@ -309,119 +917,262 @@ static inline void _UndoWaitCriticalSection(RTL_CRITICAL_SECTION *prc)
 int pthread_mutex_timedlock(pthread_mutex_t *m, const struct timespec *ts)
 {
     unsigned long long t, ct;
-#ifndef USE_MUTEX_Mutex
-    int i = 0;
-#endif
     int r;
 
     if (!ts) return pthread_mutex_lock(m);
+    if (MUTEX_PSHARED(m))
+      return _pshared_mutex_lock(m, ts);
     r = mutex_ref(m);
     if (r) return r;
 
     /* Try to lock it without waiting */
     r=_mutex_trylock(m);
-    if (r != EBUSY) return mutex_unref(m,r);
+    if (r != EBUSY) return r;
     
-    mutex_t *_m = (mutex_t *)*m;
-    if (_m->type != PTHREAD_MUTEX_NORMAL && COND_LOCKED(_m) && COND_OWNER(_m))
-      return mutex_unref(m,EDEADLK);
+    mutex_t *_m = MUTEX_PTR(m);
+    if (!COND_NORMAL(_m) && COND_LOCKED(_m) && COND_OWNER(_m))
+      return EDEADLK;
     ct = _pthread_time_in_ms();
     t = _pthread_time_in_ms_from_timespec(ts);
-#ifdef USE_MUTEX_Mutex
-   mutex_unref(m,r);
-   r = pthread_mutex_lock_intern(m, (ct > t ? 0 : (t - ct)));
-#else
-    mutex_unref(m,EDEADLK);
-    while (1)
+    r = _mutex_lock(m, (ct > t ? 0 : dwMilliSecs(t - ct)));
+    return  r;
+}
+
+/* Like pthread_mutex_timedlock, but waits for the relative time rel,
+   without reading the clock first.  */
+int pthread_mutex_reltimedlock_np(pthread_mutex_t *m, const struct timespec *rel)
+{
+    struct timespec ts;
+    mutex_t *_m;
+    int r;
+
+    if (!rel) return pthread_mutex_lock(m);
+    if (MUTEX_PSHARED(m))
     {
-        /* Have we waited long enough? A high count means we busy-waited probably.*/
-        if (ct >= t) {
-            printf("%d: Timeout after %d times\n",(int)GetCurrentThreadId(), i);
-            return ETIMEDOUT;
-        }
-        if ((i & 1) == 0)
-          Sleep(0);  /* waiter that owner gets released.  */
-        /* Try to grab lock */
-	r = pthread_mutex_trylock(m);
-	if (r != EBUSY) break;
-        /* Get current time */
-        ct = _pthread_time_in_ms();
-        i ++;
+      _pthread_abs_timespec(rel, &ts);
+      return _pshared_mutex_lock(m, &ts);
     }
-#endif
-    return  r;
+    r = mutex_ref(m);
+    if (r) return r;
+
+    r = _mutex_trylock(m);
+    if (r != EBUSY) return r;
+
+    _m = MUTEX_PTR(m);
+    if (!COND_NORMAL(_m) && COND_LOCKED(_m) && COND_OWNER(_m))
+      return EDEADLK;
+    return _mutex_lock(m, dwMilliSecs(_pthread_rel_timespec_in_ms(rel)));
 }
 
 int pthread_mutex_unlock(pthread_mutex_t *m)
 {
-    int r = mutex_ref_unlock(m);
+    int r;
+
+    if (MUTEX_PSHARED(m))
+      return _pshared_mutex_unlock(m);
+    r = mutex_ref_unlock(m);
     if(r) return r;
 
-    mutex_t *_m = (mutex_t *)*m;
-    if (_m->type == PTHREAD_MUTEX_NORMAL)
+    return _mutex_unlock(m);
+}
+
+static int
+_mutex_unlock(pthread_mutex_t *m)
+{
+    mutex_t *_m = MUTEX_PTR(m);
+    if (COND_NORMAL(_m))
     {
         if (!COND_LOCKED(_m))
-	  return mutex_unref(m,EPERM);
+	  return EPERM;
     }
     else if (!COND_LOCKED(_m) || !COND_OWNER(_m))
-        return mutex_unref(m,EPERM);
+        return EPERM;
     if (_m->type == PTHREAD_MUTEX_RECURSIVE)
     {
-      if(InterlockedDecrement(&_m->count))
-	return mutex_unref(m,0);
+      /* Checked to be the owner above, no need for atomics.  */
+      if (--_m->count != 0)
+	return 0;
     }
-#if defined USE_MUTEX_Mutex
+    if (_m->stats)
+      mutex_stats_unlocked(_m->stats);
     UNSET_OWNER(_m);
-    if (_m->h != NULL && !ReleaseSemaphore(_m->h, 1, NULL)) {
-    	SET_OWNER(_m);
-        /* restore our own bookkeeping */
-        return mutex_unref(m,EPERM);
+    if (_m->protocol != PTHREAD_PRIO_NONE)
+    {
+      struct _pthread_v *pt = mutex_prio_disown(_m);
+      int r = mutex_raw_unlock(_m);
+      mutex_prio_restore(pt);
+      return r;
     }
-#else /* USE_MUTEX_CriticalSection */
-    UNSET_OWNER(_m);
-    LeaveCriticalSection(&_m->cs.cs);
-#endif
-    return mutex_unref(m,0);
+    return mutex_raw_unlock(_m);
 }
 
 static __attribute__((noinline)) int
 _mutex_trylock(pthread_mutex_t *m)
 {
+    mutex_stats *st;
     int r = 0;
-    mutex_t *_m = (mutex_t *)*m;
-    if (_m->type != PTHREAD_MUTEX_NORMAL)
+    mutex_t *_m = MUTEX_PTR(m);
+    if (!COND_NORMAL(_m))
     {
       if (COND_LOCKED(_m))
       {
 	if (_m->type == PTHREAD_MUTEX_RECURSIVE && COND_OWNER(_m))
 	{
-	  InterlockedIncrement(&_m->count);
+	  if (_m->count == LONG_MAX)
+	    return EAGAIN;
+	  _m->count++;
 	  return 0;
 	}
 	return EBUSY;
       }
     } else if (COND_LOCKED(_m))
       return EBUSY;
-#if defined USE_MUTEX_Mutex
-    r = do_sema_b_wait_intern (_m->h, 1, 0);
-    if (r == ETIMEDOUT) r = EBUSY;
-#else /* USE_MUTEX_CriticalSection */
-    r = TryEnterCriticalSection(&_m->cs.cs) ? 0 : EBUSY;
-#endif
+    if (_m->protocol != PTHREAD_PRIO_NONE && (r = mutex_prio_check(_m)) != 0)
+      return r;
+    r = mutex_raw_trylock(_m);
     if (!r)
     {
       _m->count = 1;
       SET_OWNER(_m);
+      if (mutex_stats_on && (st = mutex_stats_ref(m, _m)) != NULL)
+	mutex_stats_locked(st);
+      if (_m->protocol != PTHREAD_PRIO_NONE)
+	mutex_prio_locked(_m);
     }
     return r;
 }
 
 int pthread_mutex_trylock(pthread_mutex_t *m)
 {
-    int r = mutex_ref(m);
+    int r;
+
+    if (MUTEX_PSHARED(m))
+      return _pshared_mutex_trylock(m);
+    r = mutex_ref(m);
+    if(r) return r;
+
+    return _mutex_trylock(m);
+}
+
+/* Single steps of mutex_lock_multiple, process-shared entries take
+   their own path as in pthread_mutex_lock.  */
+static int
+mutex_multi_lock(pthread_mutex_t *m, DWORD timeout, const struct timespec *ts)
+{
+    if (MUTEX_PSHARED(m))
+      return _pshared_mutex_lock(m, ts);
+    return _mutex_lock(m, timeout);
+}
+
+static int
+mutex_multi_trylock(pthread_mutex_t *m)
+{
+    if (MUTEX_PSHARED(m))
+      return _pshared_mutex_trylock(m);
+    return _mutex_trylock(m);
+}
+
+static void
+mutex_multi_unlock(pthread_mutex_t *m)
+{
+    if (MUTEX_PSHARED(m))
+      _pshared_mutex_unlock(m);
+    else
+      _mutex_unlock(m);
+}
+
+/* Locks all mutexes of mv, or none.  They are tried in address order,
+   while blocking only on the one which was found busy last.  On failure
+   all mutexes taken so far are released again, so no lock order among
+   the callers can deadlock.  Process-shared mutexes are ordered by
+   their key, which is the same in every process.  */
+static int
+mutex_lock_multiple(pthread_mutex_t **mv, int n, const struct timespec *ts)
+{
+    pthread_mutex_t *sv_stack[16], **sv = sv_stack;
+    unsigned long long t_end = 0, ct;
+    DWORD timeout = INFINITE;
+    int i, j, first = 0, r = 0;
+
+    if (!mv || n < 0)
+      return EINVAL;
+    if (n > 16 && !(sv = (pthread_mutex_t **) malloc(n * sizeof(*sv))))
+      return ENOMEM;
+    for (i = 0; i < n; i++)
+    {
+      if (!MUTEX_PSHARED(mv[i]) && (r = mutex_ref(mv[i])) != 0)
+	goto out;
+      for (j = i; j > 0 && MUTEX_PTR(sv[j - 1]) > MUTEX_PTR(mv[i]); j--)
+	sv[j] = sv[j - 1];
+      if (j > 0 && MUTEX_PTR(sv[j - 1]) == MUTEX_PTR(mv[i]))
+      {
+	r = EINVAL; /* the same mutex twice */
+	goto out;
+      }
+      sv[j] = mv[i];
+    }
+    if (ts)
+      t_end = _pthread_time_in_ms_from_timespec(ts);
+    while (n > 0)
+    {
+      if (ts)
+      {
+	ct = _pthread_time_in_ms();
+	timeout = (ct >= t_end ? 0 : dwMilliSecs(t_end - ct));
+      }
+      if ((r = mutex_multi_lock(sv[first], timeout, ts)) != 0)
+	break;
+      for (i = 0; i < n; i++)
+      {
+	if (i != first && (r = mutex_multi_trylock(sv[i])) != 0)
+	  break;
+      }
+      if (i == n)
+	break;
+      /* Back off, and wait for the busy one next time.  */
+      for (j = 0; j < i; j++)
+      {
+	if (j != first)
+	  mutex_multi_unlock(sv[j]);
+      }
+      mutex_multi_unlock(sv[first]);
+      if (r != EBUSY)
+	break;
+      first = i;
+    }
+out:
+    if (sv != sv_stack)
+      free(sv);
+    return r;
+}
+
+int pthread_mutex_lock_multiple_np(pthread_mutex_t **mv, int n)
+{
+    return mutex_lock_multiple(mv, n, NULL);
+}
+
+int pthread_mutex_timedlock_multiple_np(pthread_mutex_t **mv, int n, const struct timespec *ts)
+{
+    return mutex_lock_multiple(mv, n, ts);
+}
+
+/* Returns how often the calling thread holds the mutex, 0 if it
+   doesn't own it.  Only the owner changes the depth, so it is exact.  */
+int pthread_mutex_getrecursion_np(pthread_mutex_t *m, int *depth)
+{
+    mutex_t *_m;
+    int r;
+
+    if (!depth)
+      return EINVAL;
+    if (MUTEX_PSHARED(m))
+      return _pshared_mutex_getrecursion(m, depth);
+    r = mutex_ref(m);
     if(r) return r;
 
-    return mutex_unref(m,_mutex_trylock(m));
+    _m = MUTEX_PTR(m);
+    *depth = (COND_LOCKED(_m) && COND_OWNER(_m) ? (int) _m->count : 0);
+    return 0;
 }
 
 static LONG InitOnce	= 1;
@@ -446,86 +1197,201 @@ static void _mutex_init_once(mutex_t *m)
 #endif
 }
 
+/* Process-shared mutexes live in shared memory, see src/pshared.c.
+   Their owner can be a thread of any process, so they support neither
+   the priority protocols nor the FIFO policy.  */
+static int
+mutex_init_pshared(pthread_mutex_t *m, const pthread_mutexattr_t *a)
+{
+#ifdef USE_MUTEX_InPlace
+    return ENOTSUP;
+#else
+    int type, protocol, policy;
+
+    pthread_mutexattr_gettype(a, &type);
+    pthread_mutexattr_getprotocol(a, &protocol);
+    pthread_mutexattr_getpolicy_np(a, &policy);
+    if (protocol != PTHREAD_PRIO_NONE || policy != PTHREAD_MUTEX_POLICY_DEFAULT_NP)
+      return ENOTSUP;
+    return _pshared_mutex_init(m, type);
+#endif
+}
+
 int pthread_mutex_init(pthread_mutex_t *m, const pthread_mutexattr_t *a)
 {
     mutex_t *_m;
+    int policy = PTHREAD_MUTEX_POLICY_DEFAULT_NP;
+    int share = PTHREAD_PROCESS_PRIVATE;
+    int r = 0;
 
-    int r = mutex_ref_init(m);
-    if(r) return r;
+    if (!m)
+      return EINVAL;
+    if (a && pthread_mutexattr_getpshared(a, &share) == 0 && share == PTHREAD_PROCESS_SHARED)
+      return mutex_init_pshared(m, a);
 
+#ifdef USE_MUTEX_InPlace
+    _m = MUTEX_PTR(m);
+    memset(_m, 0, sizeof(*_m));
+#else
     if (!(_m = (pthread_mutex_t)calloc(1,sizeof(*_m))))
       return ENOMEM; 
+#endif
 
     _m->type = PTHREAD_MUTEX_DEFAULT;
     _m->count = 0;
+    _m->prioceiling = THREAD_PRIORITY_IDLE; /* that of default attributes */
 
     if (a) {
-        int share = PTHREAD_PROCESS_SHARED;
         r = pthread_mutexattr_gettype(a, &_m->type);
-        if (!r) r = pthread_mutexattr_getpshared(a, &share);
-        if (!r && share == PTHREAD_PROCESS_SHARED) r = ENOSYS;
+        if (!r) r = pthread_mutexattr_getpolicy_np(a, &policy);
+        if (!r) r = pthread_mutexattr_getprotocol(a, &_m->protocol);
+        if (!r) r = pthread_mutexattr_getprioceiling(a, &_m->prioceiling);
     }
-    if (!r) {
 #if defined USE_MUTEX_Mutex
-        if ( (_m->h = CreateSemaphore(NULL, 1, 0x7fffffff, NULL)) != NULL) {
+    /* The semaphore is created at first contention, see mutex_get_handle.  */
+    _m->state = MUTEX_UNLOCKED;
+    _m->h = NULL;
+    _m->policy = policy;
+    /* Mutexes which need nothing but the lock word on the uncontended
+       path can be taken by the inline fast paths of pthread_inline.h.  */
+    _m->fast = (COND_NORMAL(_m) && _m->protocol == PTHREAD_PRIO_NONE
+		&& policy == PTHREAD_MUTEX_POLICY_DEFAULT_NP);
 #else /* USE_MUTEX_CriticalSection */
-        if (InitializeCriticalSectionAndSpinCount(&_m->cs.cs, USE_MUTEX_CriticalSection_SpinCount)) {
+    if (!r && policy != PTHREAD_MUTEX_POLICY_DEFAULT_NP)
+        r = ENOSYS;
+    if (!r && !InitializeCriticalSectionAndSpinCount(&_m->cs.cs,
+		(_m->type == PTHREAD_MUTEX_ADAPTIVE_NP ? USE_MUTEX_CriticalSection_AdaptiveSpinCount
+						       : USE_MUTEX_CriticalSection_SpinCount)))
+        r = ENOMEM;
 #endif
-        } else {
-#if defined USE_MUTEX_Mutex
-            switch (GetLastError()) {
-            case ERROR_ACCESS_DENIED:
-                    r = EPERM;
-                    break;
-            default: /* We assume this, to keep it simple: */
-                    r = ENOMEM;
-            }
-#else /* USE_MUTEX_CriticalSection */
-            r = ENOMEM;
-#endif
-        }
-    } 
     if (r)
     {
         _m->valid = DEAD_MUTEX;
+#ifndef USE_MUTEX_InPlace
         free(_m);
         *m = NULL;
+#endif
         return r;
     }
     if (InterlockedExchange(&InitOnce, 0))
 	    _mutex_init_once(_m);
     _m->valid = LIFE_MUTEX;
+#ifndef USE_MUTEX_InPlace
     *m = _m;
+#endif
 
     return 0;
 }
 
 int pthread_mutex_destroy(pthread_mutex_t *m)
 {
-    pthread_mutex_t mDestroy;
-    int r = mutex_ref_destroy(m,&mDestroy);
+    mutex_t *_m;
+    int r;
+
+    if (MUTEX_PSHARED(m))
+      return _pshared_mutex_destroy(m);
+    r = mutex_ref_destroy(m,&_m);
     if(r) return r;
-    if(!mDestroy) return 0; /* destroyed a (still) static initialized mutex */
+    if(!_m) return 0; /* destroyed a (still) static initialized mutex */
 
     /* now the mutex is invalid, and no one can touch it */
-    mutex_t *_m = (mutex_t *)mDestroy;
-
+    mutex_stats_detach(_m);
 
 #if defined USE_MUTEX_Mutex
-    CloseHandle(_m->h);
+    if (_m->h != NULL)
+      CloseHandle(_m->h);
 #else /* USE_MUTEX_CriticalSection */
     DeleteCriticalSection(&_m->cs.cs);
+    if (_m->h != NULL)
+      CloseHandle(_m->h);
 #endif
     _m->valid = DEAD_MUTEX;
     _m->type  = 0;
     _m->count = 0;
-    free(mDestroy);
+#ifndef USE_MUTEX_InPlace
+    free(_m);
+#endif
+    return 0;
+}
+
+/* Turns the collection of contention statistics on or off for all
+   mutexes.  Statistics are kept after turning them off.  */
+int pthread_mutex_setstats_np(int enable)
+{
+    InterlockedExchange(&mutex_stats_on, (enable != 0));
+    return 0;
+}
+
+static void
+mutex_stats_to_ns(pthread_mutex_stats_np *s)
+{
+    s->wait_time = _pthread_ticks_to_ns(s->wait_time);
+    s->wait_time_max = _pthread_ticks_to_ns(s->wait_time_max);
+    s->hold_time = _pthread_ticks_to_ns(s->hold_time);
+}
+
+int pthread_mutex_getstats_np(pthread_mutex_t *m, pthread_mutex_stats_np *s)
+{
+    mutex_stats *st;
+    int r;
+
+    if (!s)
+      return EINVAL;
+    r = mutex_ref(m);
+    if (r) return r;
+
+    memset(s, 0, sizeof(*s));
+    if ((st = MUTEX_PTR(m)->stats) != NULL)
+    {
+      *s = st->s;
+      mutex_stats_to_ns(s);
+    }
+    return 0;
+}
+
+/* Calls func with the statistics of each live mutex which has some,
+   until it returns non-zero.  It works on a snapshot, so that func may
+   use mutexes itself.  The mutex pointers are only identifying then,
+   as the mutexes might be destroyed meanwhile.  */
+int pthread_mutex_enumstats_np(int (*func)(pthread_mutex_t *m, const pthread_mutex_stats_np *s, void *arg), void *arg)
+{
+    struct snap {
+	pthread_mutex_t *m;
+	pthread_mutex_stats_np s;
+    } *snap;
+    mutex_stats *st;
+    size_t n = 0, i;
+
+    if (!func)
+      return EINVAL;
+    _spin_lite_lock(&mutex_stats_lock);
+    for (st = mutex_stats_list; st != NULL; st = st->next)
+      n++;
+    if ((snap = (struct snap *) malloc((n ? n : 1) * sizeof(*snap))) == NULL)
+    {
+      _spin_lite_unlock(&mutex_stats_lock);
+      return ENOMEM;
+    }
+    for (i = 0, st = mutex_stats_list; st != NULL; st = st->next, i++)
+    {
+      snap[i].m = st->m;
+      snap[i].s = st->s;
+    }
+    _spin_lite_unlock(&mutex_stats_lock);
+
+    for (i = 0; i < n; i++)
+    {
+      mutex_stats_to_ns(&snap[i].s);
+      if (func(snap[i].m, &snap[i].s, arg) != 0)
+	break;
+    }
+    free(snap);
     return 0;
 }
 
 int pthread_mutexattr_init(pthread_mutexattr_t *a)
 {
-    *a = PTHREAD_MUTEX_NORMAL | (PTHREAD_PROCESS_PRIVATE << 3);
+    *a = PTHREAD_MUTEX_NORMAL; /* process private, PTHREAD_PRIO_NONE */
     return 0;
 }
 
@@ -547,7 +1413,8 @@ int pthread_mutexattr_gettype(const pthread_mutexattr_t *a, int *type)
 
 int pthread_mutexattr_settype(pthread_mutexattr_t *a, int type)
 {
-    if (!a || (type != PTHREAD_MUTEX_NORMAL && type != PTHREAD_MUTEX_RECURSIVE && type != PTHREAD_MUTEX_ERRORCHECK))
+    if (!a || (type != PTHREAD_MUTEX_NORMAL && type != PTHREAD_MUTEX_RECURSIVE && type != PTHREAD_MUTEX_ERRORCHECK
+	       && type != PTHREAD_MUTEX_ADAPTIVE_NP))
       return EINVAL;
     *a &= ~3;
     *a |= type;
@@ -566,24 +1433,20 @@ int pthread_mutexattr_getpshared(const pthread_mutexattr_t *a, int *type)
 
 int pthread_mutexattr_setpshared(pthread_mutexattr_t * a, int type)
 {
-    int r = 0;
     if (!a || (type != PTHREAD_PROCESS_SHARED && type != PTHREAD_PROCESS_PRIVATE))
       return EINVAL;
-    if (type == PTHREAD_PROCESS_SHARED)
-    {
-      type = PTHREAD_PROCESS_PRIVATE;
-      r = ENOSYS;
-    }
     type = (type == PTHREAD_PROCESS_SHARED ? 4 : 0);
 
     *a &= ~4;
     *a |= type;
 
-    return r;
+    return 0;
 }
 
 int pthread_mutexattr_getprotocol(const pthread_mutexattr_t *a, int *type)
 {
+    if (!a || !type)
+      return EINVAL;
     *type = *a & (8 + 16);
 
     return 0;
@@ -591,7 +1454,8 @@ int pthread_mutexattr_getprotocol(const pthread_mutexattr_t *a, int *type)
 
 int pthread_mutexattr_setprotocol(pthread_mutexattr_t *a, int type)
 {
-    if ((type & (8 + 16)) != 8 + 16) return EINVAL;
+    if (!a || (type != PTHREAD_PRIO_NONE && type != PTHREAD_PRIO_INHERIT && type != PTHREAD_PRIO_PROTECT))
+      return EINVAL;
 
     *a &= ~(8 + 16);
     *a |= type;
@@ -599,16 +1463,91 @@ int pthread_mutexattr_setprotocol(pthread_mutexattr_t *a, int type)
     return 0;
 }
 
+int pthread_mutexattr_getpolicy_np(const pthread_mutexattr_t *a, int *policy)
+{
+    if (!a || !policy)
+      return EINVAL;
+    *policy = (*a & 32 ? PTHREAD_MUTEX_POLICY_FIFO_NP : PTHREAD_MUTEX_POLICY_DEFAULT_NP);
+
+    return 0;
+}
+
+/* PTHREAD_MUTEX_POLICY_FIFO_NP trades throughput for bounded waits: the
+   mutex is handed to its waiters strictly in arrival order.  */
+int pthread_mutexattr_setpolicy_np(pthread_mutexattr_t *a, int policy)
+{
+    if (!a || (policy != PTHREAD_MUTEX_POLICY_DEFAULT_NP && policy != PTHREAD_MUTEX_POLICY_FIFO_NP))
+      return EINVAL;
+    *a &= ~32;
+    if (policy == PTHREAD_MUTEX_POLICY_FIFO_NP)
+      *a |= 32;
+
+    return 0;
+}
+
+/* The ceiling is a thread priority, stored relative to the lowest one
+   as it can be negative.  */
 int pthread_mutexattr_getprioceiling(const pthread_mutexattr_t *a, int * prio)
 {
-    *prio = *a / PTHREAD_PRIO_MULT;
+    if (!a || !prio)
+      return EINVAL;
+    *prio = (int) (*a / PTHREAD_PRIO_MULT) + THREAD_PRIORITY_IDLE;
     return 0;
 }
 
 int pthread_mutexattr_setprioceiling(pthread_mutexattr_t *a, int prio)
 {
+    if (!a || prio < THREAD_PRIORITY_IDLE || prio > THREAD_PRIORITY_TIME_CRITICAL)
+      return EINVAL;
     *a &= (PTHREAD_PRIO_MULT - 1);
-    *a += prio * PTHREAD_PRIO_MULT;
+    *a += (prio - THREAD_PRIORITY_IDLE) * PTHREAD_PRIO_MULT;
+
+    return 0;
+}
 
+int pthread_mutex_getprioceiling(const pthread_mutex_t *m, int *prio)
+{
+    const mutex_t *_m;
+
+    if (!m || !prio)
+      return EINVAL;
+#ifndef USE_MUTEX_InPlace
+    if (*m == NULL)
+      return EINVAL;
+    /* Static initializers and process-shared mutexes have the default
+       attributes, no need to set them up.  */
+    if (STATIC_OR_NULL(*m) || PSHARED_P(*m))
+    {
+      *prio = THREAD_PRIORITY_IDLE;
+      return 0;
+    }
+#endif
+    _m = MUTEX_PTR(m);
+    if (_m->valid != LIFE_MUTEX)
+      return EINVAL;
+    /* Any protocol has a ceiling, it only matters to PTHREAD_PRIO_PROTECT.  */
+    *prio = _m->prioceiling;
     return 0;
 }
+
+/* Changes the ceiling while holding the mutex, as POSIX wants it.  */
+int pthread_mutex_setprioceiling(pthread_mutex_t *m, int prio, int *old)
+{
+    mutex_t *_m;
+    int r;
+
+    if (prio < THREAD_PRIORITY_IDLE || prio > THREAD_PRIORITY_TIME_CRITICAL)
+      return EINVAL;
+    r = mutex_ref(m);
+    if(r) return r;
+
+    _m = MUTEX_PTR(m);
+    if (_m->protocol != PTHREAD_PRIO_PROTECT)
+      return EINVAL;
+    if ((r = _mutex_lock(m, INFINITE)) != 0)
+      return r;
+    if (old)
+      *old = _m->prioceiling;
+    _m->prioceiling = prio;
+    return _mutex_unlock(m);
+}
@@ -1,8 +1,11 @@
 #ifndef WIN_PTHREADS_MUTEX_H
 #define WIN_PTHREADS_MUTEX_H
 
-#define USE_MUTEX_Mutex
+#define USE_MUTEX_Mutex 1
 #undef USE_MUTEX_CriticalSection
+#if defined USE_MUTEX_InPlace && !defined USE_MUTEX_Mutex
+#error USE_MUTEX_InPlace needs USE_MUTEX_Mutex
+#endif
 #ifdef USE_MUTEX_CriticalSection
 #define COND_LOCKED(m)	(((_tid_u)m->cs.rc.OwningThread).tid != 0)
 #define COND_OWNER(m)	(((_tid_u)m->cs.rc.OwningThread).tid == GetCurrentThreadId())
@@ -15,23 +18,71 @@
 #define UNSET_OWNER(m)
 #define LOCK_UNDO(m)	_UndoWaitCriticalSection(&m->cs.rc)
 #else
-#define COND_LOCKED(m)	(m->owner != 0)
+#define COND_LOCKED(m)	(m->state != MUTEX_UNLOCKED)
 #define COND_OWNER(m)	(m->owner == GetCurrentThreadId())
 #define COND_DEADLK(m)	COND_OWNER(m)
 #define GET_OWNER(m)	(m->owner)
 #define GET_HANDLE(m)	(m->h)
-#define GET_LOCKCNT(m)	(m->count)
-#define GET_RCNT(m)	(m->count) /* not accurate! */
+#define GET_LOCKCNT(m)	(m->state)
+#define GET_RCNT(m)	(m->count)
 #define SET_OWNER(m)	(m->owner = GetCurrentThreadId())
 #define UNSET_OWNER(m)	{ m->owner = 0; }
 #define LOCK_UNDO(m)
 #endif
+#define COND_NORMAL(m)		(m->type == PTHREAD_MUTEX_NORMAL || m->type == PTHREAD_MUTEX_ADAPTIVE_NP)
 #define COND_DEADLK_NR(m)	((m->type != PTHREAD_MUTEX_RECURSIVE) && COND_DEADLK(m))
 #define CHECK_DEADLK(m)		{ if (COND_DEADLK_NR(m)) return EDEADLK; }
 
+/* The mutex_t behind a pthread_mutex_t *.  */
+#ifdef USE_MUTEX_InPlace
+#define MUTEX_PTR(m)		((mutex_t *)(m))
+#else
+#define MUTEX_PTR(m)		((mutex_t *)*(m))
+#endif
+
+/* Process-shared mutexes are dispatched to src/pshared.c.  InPlace
+   mutexes keep process-local handles inline, so they can't be shared.  */
+#ifdef USE_MUTEX_InPlace
+#define MUTEX_PSHARED(m)	0
+#else
+#define MUTEX_PSHARED(m)	((m) && PSHARED_P(*(m)))
+#endif
+
 #define STATIC_INITIALIZER(x)		((intptr_t)(x) >= -3 && (intptr_t)(x) <= -1)
 #define MUTEX_INITIALIZER2TYPE(x)	((LONGBAG)PTHREAD_NORMAL_MUTEX_INITIALIZER - (LONGBAG)(x))
 
+/* States of the lock word of USE_MUTEX_Mutex.  */
+#define MUTEX_UNLOCKED	0
+#define MUTEX_LOCKED	1
+#define MUTEX_CONTENDED	2	/* locked, and there might be waiters */
+
+/* States of a waiter queued on a PTHREAD_MUTEX_POLICY_FIFO_NP mutex, or
+   requeued onto a mutex by a condition variable.  */
+#define MUTEX_Q_WAITING	0	/* spinning on its node */
+#define MUTEX_Q_PARKED	1	/* blocked on its park event */
+#define MUTEX_Q_GRANTED	2	/* owns the mutex now */
+
+/* A queued waiter.  It lives on the waiter's stack, in a cache line of
+   its own, so that spinning doesn't disturb the other waiters.  */
+typedef struct mutex_qnode mutex_qnode;
+struct mutex_qnode
+{
+    mutex_qnode *next;
+    volatile LONG state;
+    HANDLE ev;
+} __attribute__((aligned(64)));
+
+/* Statistics of a mutex, attached at its first lock while they are
+   enabled.  All but waiters are only updated by the owner.  */
+typedef struct mutex_stats mutex_stats;
+struct mutex_stats
+{
+    pthread_mutex_stats_np s;	/* times in _pthread_ticks */
+    unsigned long long t_locked;	/* when the owner got it, 0 if untracked */
+    pthread_mutex_t *m;
+    mutex_stats *prev, *next;
+};
+
 #define LIFE_MUTEX 0xBAB1F00D
 #define DEAD_MUTEX 0xDEADBEEF
 
@@ -53,18 +104,35 @@ typedef struct mutex_t mutex_t;
 struct mutex_t
 {
     LONG valid;   
+    int type;		/* valid and type first, see PTHREAD_MUTEX_INITIALIZER */
+    LONG count;		/* recursion depth, only touched by the owner */
+    short fast;		/* may be locked inline, see pthread_mutex_init */
+    short policy;	/* PTHREAD_MUTEX_POLICY_DEFAULT_NP or _FIFO_NP */
+#if defined USE_MUTEX_Mutex
+    volatile LONG state;
+    DWORD owner;	/* up to here struct _pthread_mutex_head of pthread_inline.h */
+#endif
     volatile LONG busy;   
-    int type;
-    volatile LONG count;
+    mutex_stats *stats;
+    volatile LONG qlock;	/* guards the FIFO waiter queue and powner */
+    int protocol;		/* PTHREAD_PRIO_NONE, _INHERIT or _PROTECT */
+    int prioceiling;
+    struct _pthread_v *powner;	/* owner, if protocol isn't PTHREAD_PRIO_NONE */
 #if defined USE_MUTEX_Mutex
-    LONG lockOwner;
-    DWORD owner;
-    HANDLE h;
+    LONG spins;		/* averaged spin budget of PTHREAD_MUTEX_ADAPTIVE_NP */
+    HANDLE h;		/* created when the first thread has to block */
+    mutex_qnode *qhead, *qtail;
 #else /* USE_MUTEX_CriticalSection.  */
     _csu cs;
+    HANDLE h;		/* wakes timed waiters, created at the first one */
+    volatile LONG waiters;	/* number of timed waiters */
 #endif
 };
 
+/* Wait morphing for src/cond.c, see _mutex_requeue.  */
+int _mutex_requeue(pthread_mutex_t *m, mutex_qnode *q);
+void _mutex_granted(pthread_mutex_t *m);
+
 void mutex_print(volatile pthread_mutex_t *m, char *txt);
 void mutex_print_set(int state);
 
@@ -0,0 +1,829 @@
+/*
+ * Process-shared synchronization objects.
+ */
+#include <windows.h>
+#include <stdio.h>
+#include "pthread.h"
+#include "semaphore.h"
+#include "misc.h"
+#include "mutex.h"
+#include "spinlock.h"
+#include "pshared.h"
+
+int do_sema_b_wait_intern (HANDLE sema, int nointerrupt, DWORD timeout);
+
+/* This process' view of a shared object.  Entries are never unlinked,
+   so lookups can walk the table without the lock; a destroyed entry
+   just gets its key cleared for reuse.  */
+typedef struct pshared_map pshared_map;
+struct pshared_map
+{
+    pshared_map *next;
+    void * volatile key;	/* NULL if the entry is free */
+    pshared_t *p;
+    HANDLE hmap;
+    HANDLE hsem;
+};
+
+#define PSHARED_HASH		64
+#define PSHARED_SLOT(key)	((((uintptr_t)(key)) >> 1) % PSHARED_HASH)
+
+static pshared_map * volatile pshared_tab[PSHARED_HASH];
+static spin_t pshared_lock = SPIN_LITE_INITIALIZER("pshared_lock");
+
+static void
+pshared_name(char *name, void *key, char what)
+{
+    sprintf(name, "Local\\winpthreads-%p-%c", key, what);
+}
+
+/* A new odd key, below the static initializers.  Uniqueness is decided
+   by the kernel namespace, see pshared_create.  */
+static void *
+pshared_new_key(void)
+{
+    static LONG seq = 0;
+    uintptr_t k;
+
+    k = (uintptr_t) _pthread_ticks() * 2654435761u;
+    k ^= ((uintptr_t) GetCurrentProcessId() << 12) ^ (uintptr_t) InterlockedIncrement(&seq);
+    k &= ((uintptr_t) -1) >> 2;
+    return UINT2PTR((k << 1) | 1);
+}
+
+static pshared_map *
+pshared_find(void *key)
+{
+    pshared_map *pm;
+
+    for (pm = pshared_tab[PSHARED_SLOT(key)]; pm != NULL; pm = pm->next)
+    {
+      if (pm->key == key)
+	return pm;
+    }
+    return NULL;
+}
+
+/* Enters an opened object into the table.  Returns the entry of another
+   thread which was faster, the caller closes its handles then.  */
+static pshared_map *
+pshared_insert(void *key, pshared_t *p, HANDLE hmap, HANDLE hsem, int *found)
+{
+    pshared_map *pm;
+    pshared_map * volatile *head = &pshared_tab[PSHARED_SLOT(key)];
+
+    _spin_lite_lock(&pshared_lock);
+    *found = 0;
+    if ((pm = pshared_find(key)) != NULL)
+    {
+      *found = 1;
+      _spin_lite_unlock(&pshared_lock);
+      return pm;
+    }
+    for (pm = *head; pm != NULL && pm->key != NULL; pm = pm->next)
+      ;
+    if (pm == NULL)
+    {
+      if ((pm = (pshared_map *) calloc(1, sizeof(*pm))) == NULL)
+      {
+	_spin_lite_unlock(&pshared_lock);
+	return NULL;
+      }
+      pm->next = *head;
+      *head = pm;
+    }
+    pm->p = p;
+    pm->hmap = hmap;
+    pm->hsem = hsem;
+    /* Publish the key last, lookups don't take the lock.  */
+    InterlockedExchangePointer(&pm->key, key);
+    _spin_lite_unlock(&pshared_lock);
+    return pm;
+}
+
+static void
+pshared_close(pshared_t *p, HANDLE hmap, HANDLE hsem)
+{
+    if (p != NULL)
+      UnmapViewOfFile(p);
+    if (hmap != NULL)
+      CloseHandle(hmap);
+    if (hsem != NULL)
+      CloseHandle(hsem);
+}
+
+/* Maps an object created by another process, or by this one before
+   it destroyed its own mapping.  Returns EINVAL if the key is unknown,
+   or its object vanished with the last process which had it open.  */
+static int
+pshared_open(void *key, pshared_map **pmp)
+{
+    char name[64];
+    pshared_map *pm;
+    pshared_t *p;
+    HANDLE hmap, hsem;
+    int found;
+
+    pshared_name(name, key, 'm');
+    if ((hmap = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name)) == NULL)
+      return EINVAL;
+    pshared_name(name, key, 's');
+    if ((hsem = OpenSemaphoreA(SEMAPHORE_ALL_ACCESS, FALSE, name)) == NULL)
+    {
+      pshared_close(NULL, hmap, NULL);
+      return EINVAL;
+    }
+    if ((p = (pshared_t *) MapViewOfFile(hmap, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(pshared_t))) == NULL)
+    {
+      pshared_close(NULL, hmap, hsem);
+      return ENOMEM;
+    }
+    if ((pm = pshared_insert(key, p, hmap, hsem, &found)) == NULL || found)
+      pshared_close(p, hmap, hsem);
+    if (pm == NULL)
+      return ENOMEM;
+    *pmp = pm;
+    return 0;
+}
+
+/* Creates the mapping and the semaphore of a new object.  The object
+   becomes visible with pshared_publish.  */
+static int
+pshared_create(int kind, pshared_map **pmp)
+{
+    char name[64];
+    pshared_map *pm;
+    pshared_t *p;
+    HANDLE hmap, hsem;
+    void *key;
+    int found, tries;
+
+    for (tries = 0;; tries++)
+    {
+      if (tries == 16)
+	return EAGAIN;
+      key = pshared_new_key();
+      pshared_name(name, key, 'm');
+      hmap = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(pshared_t), name);
+      if (hmap == NULL)
+	return ENOMEM;
+      if (GetLastError() == ERROR_ALREADY_EXISTS)
+      {
+	CloseHandle(hmap);
+	continue;
+      }
+      pshared_name(name, key, 's');
+      hsem = CreateSemaphoreA(NULL, 0, 0x7fffffff, name);
+      if (hsem == NULL)
+      {
+	CloseHandle(hmap);
+	return EAGAIN;
+      }
+      /* The semaphore of a previous object might be alive still.  */
+      if (GetLastError() != ERROR_ALREADY_EXISTS)
+	break;
+      CloseHandle(hsem);
+      CloseHandle(hmap);
+    }
+    if ((p = (pshared_t *) MapViewOfFile(hmap, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(pshared_t))) == NULL)
+    {
+      pshared_close(NULL, hmap, hsem);
+      return ENOMEM;
+    }
+    memset(p, 0, sizeof(*p));
+    p->valid = DEAD_PSHARED;
+    p->kind = kind;
+    if ((pm = pshared_insert(key, p, hmap, hsem, &found)) == NULL)
+    {
+      pshared_close(p, hmap, hsem);
+      return ENOMEM;
+    }
+    *pmp = pm;
+    return 0;
+}
+
+static int
+pshared_publish(void **o, pshared_map *pm)
+{
+    _ReadWriteBarrier();
+    pm->p->valid = LIFE_PSHARED;
+    *o = pm->key;
+    return 0;
+}
+
+static int
+pshared_ref(void * const *o, int kind, pshared_map **pmp)
+{
+    pshared_map *pm;
+    void *key;
+    int r;
+
+    if (!o)
+      return EINVAL;
+    key = *o;
+    if (!PSHARED_P(key))
+      return EINVAL;
+    if ((pm = pshared_find(key)) == NULL && (r = pshared_open(key, &pm)) != 0)
+      return r;
+    if (pm->p->valid != LIFE_PSHARED || pm->p->kind != kind)
+      return EINVAL;
+    *pmp = pm;
+    return 0;
+}
+
+/* Invalidates the object for all processes and drops this process'
+   mapping.  Other processes keep theirs until they exit.  */
+static int
+pshared_destroy(void **o, pshared_map *pm)
+{
+    pshared_t *p = pm->p;
+    HANDLE hmap = pm->hmap, hsem = pm->hsem;
+
+    p->valid = DEAD_PSHARED;
+    *o = NULL;
+    _spin_lite_lock(&pshared_lock);
+    InterlockedExchangePointer(&pm->key, NULL);
+    pm->p = NULL;
+    pm->hmap = pm->hsem = NULL;
+    _spin_lite_unlock(&pshared_lock);
+    pshared_close(p, hmap, hsem);
+    return 0;
+}
+
+static DWORD
+pshared_timeout(const struct timespec *ts)
+{
+    return (ts ? dwMilliSecs(_pthread_rel_time_in_ms(ts)) : INFINITE);
+}
+
+/* Blocks until pshared_wake, unless *addr doesn't hold val anymore.
+   Returns 0 when woken or on a changed value; callers recheck their
+   condition.  A waker takes waiters off the count before it releases
+   them, so a waiter giving up leaves the count only if it is still on
+   it, and consumes the token sent to it otherwise.  That keeps the
+   semaphore from accumulating stale wake ups.  */
+static int
+pshared_wait(pshared_map *pm, volatile LONG *addr, LONG val, DWORD timeout, int cancel)
+{
+    pshared_t *p = pm->p;
+    LONG w;
+    int r = 0;
+
+    InterlockedIncrement(&p->waiters);
+    if (*addr == val)
+    {
+      r = do_sema_b_wait_intern(pm->hsem, (cancel ? 2 : 1), timeout);
+      if (r == 0)
+	return 0;
+    }
+    do {
+      w = p->waiters;
+      if (w <= 0)
+      {
+	WaitForSingleObject(pm->hsem, INFINITE);
+	return 0;
+      }
+    } while (InterlockedCompareExchange(&p->waiters, w - 1, w) != w);
+    return r;
+}
+
+static void
+pshared_wake(pshared_map *pm, LONG n)
+{
+    pshared_t *p = pm->p;
+    LONG w, k;
+
+    do {
+      w = p->waiters;
+      if (w <= 0)
+	return;
+      k = (n < w ? n : w);
+    } while (InterlockedCompareExchange(&p->waiters, w - k, w) != w);
+    ReleaseSemaphore(pm->hsem, k, NULL);
+}
+
+/* Mutexes, a lock word as USE_MUTEX_Mutex.  InPlace mutexes are
+   never process-shared, see mutex_init_pshared.  */
+#ifndef USE_MUTEX_InPlace
+
+int _pshared_mutex_init(pthread_mutex_t *m, int type)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_create(PSHARED_MUTEX, &pm)) != 0)
+      return r;
+    pm->p->u.m.state = MUTEX_UNLOCKED;
+    pm->p->u.m.type = (type == PTHREAD_MUTEX_ADAPTIVE_NP ? PTHREAD_MUTEX_NORMAL : type);
+    return pshared_publish(m, pm);
+}
+
+int _pshared_mutex_destroy(pthread_mutex_t *m)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_ref(m, PSHARED_MUTEX, &pm)) != 0)
+      return r;
+    if (pm->p->u.m.state != MUTEX_UNLOCKED)
+      return EBUSY;
+    return pshared_destroy(m, pm);
+}
+
+int _pshared_mutex_lock(pthread_mutex_t *m, const struct timespec *ts)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    LONG c;
+    int r;
+
+    if ((r = pshared_ref(m, PSHARED_MUTEX, &pm)) != 0)
+      return r;
+    p = pm->p;
+    if (p->u.m.type != PTHREAD_MUTEX_NORMAL && p->u.m.owner == GetCurrentThreadId())
+    {
+      if (p->u.m.type != PTHREAD_MUTEX_RECURSIVE)
+	return EDEADLK;
+      if (p->u.m.count == LONG_MAX)
+	return EAGAIN;
+      p->u.m.count++;
+      return 0;
+    }
+    c = InterlockedCompareExchange(&p->u.m.state, MUTEX_LOCKED, MUTEX_UNLOCKED);
+    if (c != MUTEX_UNLOCKED)
+    {
+      if (c != MUTEX_CONTENDED)
+	c = InterlockedExchange(&p->u.m.state, MUTEX_CONTENDED);
+      while (c != MUTEX_UNLOCKED)
+      {
+	if ((r = pshared_wait(pm, &p->u.m.state, MUTEX_CONTENDED, pshared_timeout(ts), 0)) != 0)
+	  return r;
+	c = InterlockedExchange(&p->u.m.state, MUTEX_CONTENDED);
+      }
+    }
+    p->u.m.owner = GetCurrentThreadId();
+    p->u.m.count = 1;
+    return 0;
+}
+
+int _pshared_mutex_trylock(pthread_mutex_t *m)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    int r;
+
+    if ((r = pshared_ref(m, PSHARED_MUTEX, &pm)) != 0)
+      return r;
+    p = pm->p;
+    if (p->u.m.type == PTHREAD_MUTEX_RECURSIVE && p->u.m.owner == GetCurrentThreadId())
+    {
+      if (p->u.m.count == LONG_MAX)
+	return EAGAIN;
+      p->u.m.count++;
+      return 0;
+    }
+    if (InterlockedCompareExchange(&p->u.m.state, MUTEX_LOCKED, MUTEX_UNLOCKED) != MUTEX_UNLOCKED)
+      return EBUSY;
+    p->u.m.owner = GetCurrentThreadId();
+    p->u.m.count = 1;
+    return 0;
+}
+
+int _pshared_mutex_unlock(pthread_mutex_t *m)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    int r;
+
+    if ((r = pshared_ref(m, PSHARED_MUTEX, &pm)) != 0)
+      return r;
+    p = pm->p;
+    if (p->u.m.state == MUTEX_UNLOCKED)
+      return EPERM;
+    if (p->u.m.type != PTHREAD_MUTEX_NORMAL)
+    {
+      if (p->u.m.owner != GetCurrentThreadId())
+	return EPERM;
+      if (p->u.m.type == PTHREAD_MUTEX_RECURSIVE && --p->u.m.count != 0)
+	return 0;
+    }
+    p->u.m.owner = 0;
+    if (InterlockedExchange(&p->u.m.state, MUTEX_UNLOCKED) == MUTEX_CONTENDED)
+      pshared_wake(pm, 1);
+    return 0;
+}
+
+int _pshared_mutex_getrecursion(pthread_mutex_t *m, int *depth)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    int r;
+
+    if ((r = pshared_ref(m, PSHARED_MUTEX, &pm)) != 0)
+      return r;
+    p = pm->p;
+    *depth = (p->u.m.state != MUTEX_UNLOCKED && p->u.m.owner == GetCurrentThreadId()
+	      ? (int) p->u.m.count : 0);
+    return 0;
+}
+
+#endif
+
+/* Condition variables.  A waiter sleeps as long as the sequence number
+   it saw under the mutex is current.  */
+
+int _pshared_cond_init(pthread_cond_t *c, clockid_t clock)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_create(PSHARED_COND, &pm)) != 0)
+      return r;
+    pm->p->u.c.clock = clock;
+    return pshared_publish(c, pm);
+}
+
+int _pshared_cond_destroy(pthread_cond_t *c)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_ref(c, PSHARED_COND, &pm)) != 0)
+      return r;
+    if (pm->p->waiters != 0)
+      return EBUSY;
+    return pshared_destroy(c, pm);
+}
+
+int _pshared_cond_signal(pthread_cond_t *c, int all)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_ref(c, PSHARED_COND, &pm)) != 0)
+      return r;
+    InterlockedIncrement(&pm->p->u.c.seq);
+    pshared_wake(pm, (all ? LONG_MAX : 1));
+    return 0;
+}
+
+/* Waits until ts on the clock of c, or for rel without ts.  */
+int _pshared_cond_wait(pthread_cond_t *c, pthread_mutex_t *m, const struct timespec *ts, DWORD rel)
+{
+    pshared_map *pm;
+    LONG seq;
+    DWORD timeout;
+    int r, r2;
+
+    if ((r = pshared_ref(c, PSHARED_COND, &pm)) != 0)
+      return r;
+    timeout = (ts ? dwMilliSecs(_pthread_clock_rel_time_in_ms(pm->p->u.c.clock, ts)) : rel);
+    seq = pm->p->u.c.seq;
+    if ((r = pthread_mutex_unlock(m)) != 0)
+      return r;
+    r = pshared_wait(pm, &pm->p->u.c.seq, seq, timeout, 1);
+    r2 = pthread_mutex_lock(m);
+    /* A cancelled waiter leaves with the mutex held.  */
+    if (r == EINVAL)
+      pthread_testcancel();
+    return (r2 != 0 ? r2 : r);
+}
+
+/* Read-write locks, they prefer readers.  */
+
+int _pshared_rwlock_init(pthread_rwlock_t *rw)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_create(PSHARED_RWLOCK, &pm)) != 0)
+      return r;
+    return pshared_publish(rw, pm);
+}
+
+int _pshared_rwlock_destroy(pthread_rwlock_t *rw)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_ref(rw, PSHARED_RWLOCK, &pm)) != 0)
+      return r;
+    if (pm->p->u.rw.state != 0)
+      return EBUSY;
+    return pshared_destroy(rw, pm);
+}
+
+int _pshared_rwlock_rdlock(pthread_rwlock_t *rw, const struct timespec *ts)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    LONG s;
+    int r;
+
+    if ((r = pshared_ref(rw, PSHARED_RWLOCK, &pm)) != 0)
+      return r;
+    p = pm->p;
+    for (;;)
+    {
+      s = p->u.rw.state;
+      if (s >= 0)
+      {
+	if (s >= MAX_READ_LOCKS)
+	  return EAGAIN;
+	if (InterlockedCompareExchange(&p->u.rw.state, s + 1, s) == s)
+	  return 0;
+      }
+      else if ((r = pshared_wait(pm, &p->u.rw.state, s, pshared_timeout(ts), 0)) != 0)
+	return r;
+    }
+}
+
+int _pshared_rwlock_wrlock(pthread_rwlock_t *rw, const struct timespec *ts)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    LONG s;
+    int r;
+
+    if ((r = pshared_ref(rw, PSHARED_RWLOCK, &pm)) != 0)
+      return r;
+    p = pm->p;
+    while ((s = InterlockedCompareExchange(&p->u.rw.state, -1, 0)) != 0)
+    {
+      if ((r = pshared_wait(pm, &p->u.rw.state, s, pshared_timeout(ts), 0)) != 0)
+	return r;
+    }
+    return 0;
+}
+
+int _pshared_rwlock_tryrdlock(pthread_rwlock_t *rw)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    LONG s;
+    int r;
+
+    if ((r = pshared_ref(rw, PSHARED_RWLOCK, &pm)) != 0)
+      return r;
+    p = pm->p;
+    while ((s = p->u.rw.state) >= 0)
+    {
+      if (s >= MAX_READ_LOCKS)
+	return EAGAIN;
+      if (InterlockedCompareExchange(&p->u.rw.state, s + 1, s) == s)
+	return 0;
+    }
+    return EBUSY;
+}
+
+int _pshared_rwlock_trywrlock(pthread_rwlock_t *rw)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_ref(rw, PSHARED_RWLOCK, &pm)) != 0)
+      return r;
+    return (InterlockedCompareExchange(&pm->p->u.rw.state, -1, 0) == 0 ? 0 : EBUSY);
+}
+
+int _pshared_rwlock_unlock(pthread_rwlock_t *rw)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    LONG s;
+    int r;
+
+    if ((r = pshared_ref(rw, PSHARED_RWLOCK, &pm)) != 0)
+      return r;
+    p = pm->p;
+    s = p->u.rw.state;
+    if (s == 0)
+      return EPERM;
+    if (s < 0)
+      InterlockedExchange(&p->u.rw.state, 0);
+    else if (InterlockedDecrement(&p->u.rw.state) != 0)
+      return 0;
+    /* Readers wait for a writer, writers for all of them.  */
+    pshared_wake(pm, LONG_MAX);
+    return 0;
+}
+
+/* Barriers.  */
+
+int _pshared_barrier_init(pthread_barrier_t *b, unsigned int count)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_create(PSHARED_BARRIER, &pm)) != 0)
+      return r;
+    pm->p->u.b.left = pm->p->u.b.count = count;
+    return pshared_publish(b, pm);
+}
+
+int _pshared_barrier_destroy(pthread_barrier_t *b)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_ref(b, PSHARED_BARRIER, &pm)) != 0)
+      return r;
+    if (pm->p->u.b.left != pm->p->u.b.count)
+      return EBUSY;
+    return pshared_destroy(b, pm);
+}
+
+int _pshared_barrier_wait(pthread_barrier_t *b)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    LONG gen;
+    int r;
+
+    if ((r = pshared_ref(b, PSHARED_BARRIER, &pm)) != 0)
+      return r;
+    p = pm->p;
+    gen = p->u.b.gen;
+    if (InterlockedDecrement(&p->u.b.left) == 0)
+    {
+      /* Nobody can arrive for the next round before gen moves on.  */
+      p->u.b.left = p->u.b.count;
+      InterlockedIncrement(&p->u.b.gen);
+      pshared_wake(pm, LONG_MAX);
+      return PTHREAD_BARRIER_SERIAL_THREAD;
+    }
+    while (p->u.b.gen == gen)
+    {
+      if ((r = pshared_wait(pm, &p->u.b.gen, gen, INFINITE, 0)) != 0)
+	return r;
+    }
+    return 0;
+}
+
+/* Semaphores, errors are returned for sem.c to set errno.  */
+
+int _pshared_sem_init(sem_t *sem, unsigned int value)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_create(PSHARED_SEM, &pm)) != 0)
+      return r;
+    pm->p->u.s.value = (LONG) value;
+    return pshared_publish(sem, pm);
+}
+
+int _pshared_sem_destroy(sem_t *sem)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_ref(sem, PSHARED_SEM, &pm)) != 0)
+      return r;
+    if (pm->p->waiters != 0)
+      return EBUSY;
+    return pshared_destroy(sem, pm);
+}
+
+int _pshared_sem_wait(sem_t *sem, const struct timespec *ts)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    LONG v;
+    int r;
+
+    pthread_testcancel();
+    if ((r = pshared_ref(sem, PSHARED_SEM, &pm)) != 0)
+      return r;
+    p = pm->p;
+    for (;;)
+    {
+      v = p->u.s.value;
+      if (v > 0)
+      {
+	if (InterlockedCompareExchange(&p->u.s.value, v - 1, v) == v)
+	  return 0;
+	continue;
+      }
+      if ((r = pshared_wait(pm, &p->u.s.value, v, pshared_timeout(ts), 1)) != 0)
+      {
+	if (r == EINVAL)
+	  pthread_testcancel();
+	return r;
+      }
+    }
+}
+
+int _pshared_sem_trywait(sem_t *sem)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    LONG v;
+    int r;
+
+    if ((r = pshared_ref(sem, PSHARED_SEM, &pm)) != 0)
+      return r;
+    p = pm->p;
+    while ((v = p->u.s.value) > 0)
+    {
+      if (InterlockedCompareExchange(&p->u.s.value, v - 1, v) == v)
+	return 0;
+    }
+    return EAGAIN;
+}
+
+int _pshared_sem_post(sem_t *sem, int count)
+{
+    pshared_map *pm;
+    pshared_t *p;
+    LONG v;
+    int r;
+
+    if ((r = pshared_ref(sem, PSHARED_SEM, &pm)) != 0)
+      return r;
+    if (count <= 0)
+      return EINVAL;
+    p = pm->p;
+    do {
+      v = p->u.s.value;
+      if ((long long) v + (long long) count > (long long) SEM_VALUE_MAX)
+	return ERANGE;
+    } while (InterlockedCompareExchange(&p->u.s.value, v + count, v) != v);
+    pshared_wake(pm, count);
+    return 0;
+}
+
+int _pshared_sem_getvalue(sem_t *sem, int *sval)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_ref(sem, PSHARED_SEM, &pm)) != 0)
+      return r;
+    *sval = (int) pm->p->u.s.value;
+    return 0;
+}
+
+/* Spinlocks, ticket locks as private ones.  These never block.  */
+
+int _pshared_spin_init(pthread_spinlock_t *l)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_create(PSHARED_SPIN, &pm)) != 0)
+      return r;
+    return pshared_publish(l, pm);
+}
+
+int _pshared_spin_destroy(pthread_spinlock_t *l)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_ref(l, PSHARED_SPIN, &pm)) != 0)
+      return r;
+    if (SPIN_TICKET_BUSY(&pm->p->u.sp))
+      return EBUSY;
+    return pshared_destroy(l, pm);
+}
+
+int _pshared_spin_lock(pthread_spinlock_t *l)
+{
+    pshared_map *pm;
+    int r, spins;
+
+    if ((r = pshared_ref(l, PSHARED_SPIN, &pm)) != 0)
+      return r;
+    return _spin_ticket_lock(&pm->p->u.sp, &spins);
+}
+
+int _pshared_spin_timedlock(pthread_spinlock_t *l, const struct timespec *ts)
+{
+    pshared_map *pm;
+    int r, spins;
+
+    if ((r = pshared_ref(l, PSHARED_SPIN, &pm)) != 0)
+      return r;
+    return _spin_ticket_timedlock(&pm->p->u.sp, ts, &spins);
+}
+
+int _pshared_spin_trylock(pthread_spinlock_t *l)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_ref(l, PSHARED_SPIN, &pm)) != 0)
+      return r;
+    return _spin_ticket_trylock(&pm->p->u.sp);
+}
+
+int _pshared_spin_unlock(pthread_spinlock_t *l)
+{
+    pshared_map *pm;
+    int r;
+
+    if ((r = pshared_ref(l, PSHARED_SPIN, &pm)) != 0)
+      return r;
+    return _spin_ticket_unlock(&pm->p->u.sp);
+}
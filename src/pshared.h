@@ -0,0 +1,98 @@
+#ifndef WIN_PTHREADS_PSHARED_H
+#define WIN_PTHREADS_PSHARED_H
+
+#include "../include/semaphore.h"
+#include "spinlock.h"
+
+/* An object initialized PTHREAD_PROCESS_SHARED holds an odd key in place
+   of the pointer to its state.  The state lives in a file mapping named
+   after the key, so every process mapping the caller's shared memory
+   finds it, and threads block on a semaphore named after the key.
+   Uncontended operations don't call into the kernel.  Some static
+   initializers are odd too, hence the STATIC_OR_NULL.  */
+#define PSHARED_P(x)		((((uintptr_t)(x)) & 1) != 0 && !STATIC_OR_NULL(x))
+
+#define LIFE_PSHARED 0xBAB1F5ED
+#define DEAD_PSHARED 0xDEADF5EF
+
+/* Kinds of shared objects.  */
+#define PSHARED_MUTEX	1
+#define PSHARED_COND	2
+#define PSHARED_RWLOCK	3
+#define PSHARED_BARRIER	4
+#define PSHARED_SEM	5
+#define PSHARED_SPIN	6
+
+/* The state in shared memory.  Only 32 bit fields and no pointers, as
+   it is mapped at a different address in every process.  */
+typedef struct pshared_t pshared_t;
+struct pshared_t
+{
+    unsigned int valid;
+    int kind;
+    volatile LONG waiters;	/* blocked on the semaphore, see pshared_wait */
+    union {
+	struct {
+	    volatile LONG state;	/* MUTEX_UNLOCKED, _LOCKED or _CONTENDED */
+	    int type;
+	    DWORD owner;		/* thread ids are unique system-wide */
+	    LONG count;
+	} m;
+	struct {
+	    volatile LONG seq;	/* bumped by every signal and broadcast */
+	    int clock;		/* of timed waits */
+	} c;
+	struct {
+	    volatile LONG state;	/* number of readers, -1 if write locked */
+	} rw;
+	struct {
+	    volatile LONG left;	/* threads still to arrive */
+	    LONG count;
+	    volatile LONG gen;	/* bumped when the barrier opens */
+	} b;
+	struct {
+	    volatile LONG value;
+	} s;
+	spin_ticket_t sp;
+    } u;
+};
+
+int _pshared_mutex_init(pthread_mutex_t *m, int type);
+int _pshared_mutex_destroy(pthread_mutex_t *m);
+int _pshared_mutex_lock(pthread_mutex_t *m, const struct timespec *ts);
+int _pshared_mutex_trylock(pthread_mutex_t *m);
+int _pshared_mutex_unlock(pthread_mutex_t *m);
+int _pshared_mutex_getrecursion(pthread_mutex_t *m, int *depth);
+
+int _pshared_cond_init(pthread_cond_t *c, clockid_t clock);
+int _pshared_cond_destroy(pthread_cond_t *c);
+int _pshared_cond_signal(pthread_cond_t *c, int all);
+int _pshared_cond_wait(pthread_cond_t *c, pthread_mutex_t *m, const struct timespec *ts, DWORD rel);
+
+int _pshared_rwlock_init(pthread_rwlock_t *rw);
+int _pshared_rwlock_destroy(pthread_rwlock_t *rw);
+int _pshared_rwlock_rdlock(pthread_rwlock_t *rw, const struct timespec *ts);
+int _pshared_rwlock_wrlock(pthread_rwlock_t *rw, const struct timespec *ts);
+int _pshared_rwlock_tryrdlock(pthread_rwlock_t *rw);
+int _pshared_rwlock_trywrlock(pthread_rwlock_t *rw);
+int _pshared_rwlock_unlock(pthread_rwlock_t *rw);
+
+int _pshared_barrier_init(pthread_barrier_t *b, unsigned int count);
+int _pshared_barrier_destroy(pthread_barrier_t *b);
+int _pshared_barrier_wait(pthread_barrier_t *b);
+
+int _pshared_sem_init(sem_t *sem, unsigned int value);
+int _pshared_sem_destroy(sem_t *sem);
+int _pshared_sem_wait(sem_t *sem, const struct timespec *ts);
+int _pshared_sem_trywait(sem_t *sem);
+int _pshared_sem_post(sem_t *sem, int count);
+int _pshared_sem_getvalue(sem_t *sem, int *sval);
+
+int _pshared_spin_init(pthread_spinlock_t *l);
+int _pshared_spin_destroy(pthread_spinlock_t *l);
+int _pshared_spin_lock(pthread_spinlock_t *l);
+int _pshared_spin_timedlock(pthread_spinlock_t *l, const struct timespec *ts);
+int _pshared_spin_trylock(pthread_spinlock_t *l);
+int _pshared_spin_unlock(pthread_spinlock_t *l);
+
+#endif
@@ -6,19 +6,20 @@
 #include "rwlock.h"
 #include "spinlock.h"
 #include "misc.h"
+#include "pshared.h"
 
-static spin_t rwl_global = {0,LIFE_SPINLOCK,0};
+static spin_stripe rwl_global[SPIN_STRIPES] = SPIN_STRIPES_INITIALIZER("rwl_global");
 
 static __attribute__((noinline)) int rwlock_static_init(pthread_rwlock_t *rw);
 
 static __attribute__ ((noinline)) int rwl_unref(volatile pthread_rwlock_t *rwl, int res)
 {
-    _spin_lite_lock(&rwl_global);
+    _spin_lite_lock(SPIN_STRIPE(rwl_global, rwl));
 #ifdef WINPTHREAD_DBG
     assert((((rwlock_t *)*rwl)->valid == LIFE_RWLOCK) && (((rwlock_t *)*rwl)->busy > 0));
 #endif
      ((rwlock_t *)*rwl)->busy--;
-    _spin_lite_unlock(&rwl_global);
+    _spin_lite_unlock(SPIN_STRIPE(rwl_global, rwl));
     return res;
 }
 
@@ -26,14 +27,14 @@ static __attribute__((noinline)) int rwl_ref(pthread_rwlock_t *rwl, int f )
 {
     int r = 0;
     INIT_RWLOCK(rwl);
-    _spin_lite_lock(&rwl_global);
+    _spin_lite_lock(SPIN_STRIPE(rwl_global, rwl));
 
     if (!rwl || !*rwl || ((rwlock_t *)*rwl)->valid != LIFE_RWLOCK) r = EINVAL;
     else {
         ((rwlock_t *)*rwl)->busy ++;
     }
 
-    _spin_lite_unlock(&rwl_global);
+    _spin_lite_unlock(SPIN_STRIPE(rwl_global, rwl));
 
     return r;
 }
@@ -42,15 +43,16 @@ static __attribute__((noinline)) int rwl_ref_unlock(pthread_rwlock_t *rwl )
 {
     int r = 0;
 
-    _spin_lite_lock(&rwl_global);
+    _spin_lite_lock(SPIN_STRIPE(rwl_global, rwl));
 
-    if (!rwl || !*rwl || ((rwlock_t *)*rwl)->valid != LIFE_RWLOCK) r = EINVAL;
+    if (!rwl || !*rwl) r = EINVAL;
     else if (STATIC_RWL_INITIALIZER(*rwl)) r= EPERM;
+    else if (((rwlock_t *)*rwl)->valid != LIFE_RWLOCK) r = EINVAL;
     else {
         ((rwlock_t *)*rwl)->busy ++;
     }
 
-    _spin_lite_unlock(&rwl_global);
+    _spin_lite_unlock(SPIN_STRIPE(rwl_global, rwl));
 
     return r;
 }
@@ -60,12 +62,18 @@ static __attribute__((noinline)) int rwl_ref_destroy(pthread_rwlock_t *rwl, pthr
     int r = 0;
 
     *rDestroy = NULL;
-    if (_spin_lite_trylock(&rwl_global)) return EBUSY;
+    /* The stripe is shared with unrelated rwlocks, only busy counts.  */
+    _spin_lite_lock(SPIN_STRIPE(rwl_global, rwl));
     
     if (!rwl || !*rwl) r = EINVAL;
     else {
         rwlock_t *r_ = (rwlock_t *)*rwl;
-        if (STATIC_RWL_INITIALIZER(*rwl)) *rwl = NULL;
+        if (STATIC_RWL_INITIALIZER(r_))
+        {
+            /* Fails if someone initializes it concurrently.  */
+            if (InterlockedCompareExchangePointer(rwl, NULL, r_) != r_)
+                r = EBUSY;
+        }
         else if (r_->valid != LIFE_RWLOCK) r = EINVAL;
         else if (r_->busy) r = EBUSY;
         else {
@@ -74,10 +82,11 @@ static __attribute__((noinline)) int rwl_ref_destroy(pthread_rwlock_t *rwl, pthr
         }
     }
 
-    _spin_lite_unlock(&rwl_global);
+    _spin_lite_unlock(SPIN_STRIPE(rwl_global, rwl));
     return r;
 }
 
+#if defined USE_RWLOCK_pthread_cond
 static int rwlock_gain_both_locks(rwlock_t *rwlock)
 {
   int ret;
@@ -101,6 +110,7 @@ static int rwlock_free_both_locks(rwlock_t *rwlock, int last_fail)
     ret = ret2;
   return ret;
 }
+#endif
 
 #ifdef WINPTHREAD_DBG
 static int print_state = 0;
@@ -126,23 +136,694 @@ void rwl_print(volatile pthread_rwlock_t *rwl, char *txt)
 }
 #endif
 
-static spin_t cond_locked = {0,LIFE_SPINLOCK,0};
-
+/* Initializes privately and publishes with a compare-and-swap over
+   the static initializer, the loser of a race frees its copy.  */
 static __attribute__((noinline)) int rwlock_static_init(pthread_rwlock_t *rw)
 {
+  pthread_rwlock_t nrw = NULL;
   int r;
-  _spin_lite_lock(&cond_locked);
+
   if (*rw != PTHREAD_RWLOCK_INITIALIZER)
-  {
-    _spin_lite_unlock(&cond_locked);
+    /* NULL is destroyed, otherwise we assume someone was faster ... */
+    return (*rw == NULL ? EINVAL : 0);
+  r = pthread_rwlock_init (&nrw, NULL);
+  if (r != 0)
+    return r;
+  if (InterlockedCompareExchangePointer(rw, nrw, PTHREAD_RWLOCK_INITIALIZER) != PTHREAD_RWLOCK_INITIALIZER)
+    pthread_rwlock_destroy (&nrw);
+  return 0;
+}
+
+#if defined USE_RWLOCK_Atomic
+int do_sema_b_wait_intern (HANDLE sema, int nointerrupt, DWORD timeout);
+
+/* Short-term lock of the waiter queue, never held while blocking.  */
+static void
+rwlock_qlock(rwlock_t *rwlock)
+{
+    while (InterlockedExchange(&rwlock->qlock, 1) != 0)
+    {
+      while (rwlock->qlock != 0)
+	YieldProcessor();
+    }
+}
+
+#define rwlock_qunlock(rw)	InterlockedExchange(&(rw)->qlock, 0)
+
+/* The lock of an initialized rwlock, or NULL if it needs the checks
+   and the static initialization of rwl_ref.  The fast paths skip
+   those, as using a lock while destroying it is undefined anyway.  */
+static __inline__ rwlock_t *
+rwlock_plain(pthread_rwlock_t *rwlock_)
+{
+    rwlock_t *rwlock;
+
+    if (!rwlock_ || STATIC_OR_NULL(*rwlock_))
+      return NULL;
+    rwlock = (rwlock_t *)*rwlock_;
+    return (rwlock->valid == LIFE_RWLOCK ? rwlock : NULL);
+}
+
+/* Takes the lock if nobody holds it in the way and nobody is queued
+   for it.  Returns EBUSY otherwise, or EAGAIN at the reader limit.  */
+static int
+rwlock_try(rwlock_t *rwlock, int shared)
+{
+    LONG s;
+
+    for (;;)
+    {
+      s = rwlock->state;
+      if (shared)
+      {
+	if ((s & (RWL_WRITER | RWL_WAITING)) != 0)
+	  return EBUSY;
+	if ((s & RWL_READERS) == RWL_READERS)
+	  return EAGAIN;
+	if (InterlockedCompareExchange(&rwlock->state, s + 1, s) == s)
+	  return 0;
+      }
+      else
+      {
+	if (s != 0)
+	  return EBUSY;
+	if (InterlockedCompareExchange(&rwlock->state, RWL_WRITER, 0) == 0)
+	{
+	  rwlock->writer = GetCurrentThreadId();
+	  return 0;
+	}
+      }
+    }
+}
+
+/* Hands the lock to the waiters at the head of the queue as long as
+   they can have it, called with qlock held.  Returns them linked
+   through next, for rwlock_wake once qlock is released.  */
+static rwlock_waiter *
+rwlock_grant(rwlock_t *rwlock)
+{
+    rwlock_waiter *w, *head = NULL, **tail = &head;
+    LONG s, n;
+
+    while ((w = rwlock->qhead) != NULL)
+    {
+      s = rwlock->state;
+      if (w->shared
+	  ? (s & RWL_WRITER) != 0 || (s & RWL_READERS) == RWL_READERS
+	  : (s & (RWL_WRITER | RWL_READERS)) != 0)
+	break;
+      n = (w->shared ? s + 1 : s | RWL_WRITER);
+      if (w->next == NULL)
+	n &= ~RWL_WAITING;
+      if (InterlockedCompareExchange(&rwlock->state, n, s) != s)
+	continue;
+      if ((rwlock->qhead = w->next) == NULL)
+	rwlock->qtail = NULL;
+      w->queued = 0;
+      w->next = NULL;
+      *tail = w;
+      tail = &w->next;
+    }
+    return head;
+}
+
+/* Tells the granted waiters, which are gone as soon as they run.  */
+static void
+rwlock_wake(rwlock_waiter *w)
+{
+    rwlock_waiter *n;
+    HANDLE ev;
+
+    for (; w != NULL; w = n)
+    {
+      n = w->next;
+      ev = w->ev;
+      if (InterlockedExchange(&w->state, RWL_Q_GRANTED) == RWL_Q_PARKED)
+	SetEvent(ev);
+    }
+}
+
+/* Takes w off the queue after a timeout or a cancellation request,
+   unless a grant did already.  Returns 0 if it did, the lock is held
+   then.  */
+static int
+rwlock_unqueue(rwlock_t *rwlock, rwlock_waiter *w)
+{
+    rwlock_waiter *p, *g;
+    LONG s;
+
+    rwlock_qlock(rwlock);
+    if (!w->queued)
+    {
+      rwlock_qunlock(rwlock);
+      return 0;
+    }
+    if (rwlock->qhead == w)
+      p = NULL;
+    else
+      for (p = rwlock->qhead; p->next != w; p = p->next)
+	;
+    if (p)
+      p->next = w->next;
+    else
+      rwlock->qhead = w->next;
+    if (rwlock->qtail == w)
+      rwlock->qtail = p;
+    if (rwlock->qhead == NULL)
+    {
+      do
+	s = rwlock->state;
+      while (InterlockedCompareExchange(&rwlock->state, s & ~RWL_WAITING, s) != s);
+    }
+    /* Readers behind a writer which gave up may go ahead now.  */
+    g = rwlock_grant(rwlock);
+    rwlock_qunlock(rwlock);
+    rwlock_wake(g);
+    return -1;
+}
+
+/* The slow path of the locks, after rwlock_try failed.  Waits until
+   ts on CLOCK_REALTIME, or without ts for the relative rel, which is
+   INFINITE for untimed locks.  Returns EINVAL after a cancellation
+   request, which the caller acts on.  */
+static int
+rwlock_wait(rwlock_t *rwlock, int shared, const struct timespec *ts, DWORD rel)
+{
+    rwlock_waiter w;
+    DWORD timeout, t0 = 0, dt;
+    LONG s;
+    int r, cnt;
+
+    if ((w.ev = _pthread_get_park_event()) == NULL)
+      return ENOMEM;
+    w.next = NULL;
+    w.state = RWL_Q_WAITING;
+    w.shared = shared;
+    w.queued = 1;
+
+    rwlock_qlock(rwlock);
+    /* Setting RWL_WAITING sends the unlocks to the queue.  */
+    for (;;)
+    {
+      s = rwlock->state;
+      if ((s & RWL_WAITING) == 0 && (r = rwlock_try(rwlock, shared)) != EBUSY)
+      {
+	rwlock_qunlock(rwlock);
+	return r;
+      }
+      if (InterlockedCompareExchange(&rwlock->state, s | RWL_WAITING, s) == s)
+	break;
+    }
+    if (rwlock->qtail)
+      rwlock->qtail->next = &w;
+    else
+      rwlock->qhead = &w;
+    rwlock->qtail = &w;
+    rwlock_qunlock(rwlock);
+
+    timeout = (ts ? dwMilliSecs(_pthread_clock_rel_time_in_ms(CLOCK_REALTIME, ts)) : rel);
+    if (_pthread_num_cpus() > 1 && timeout != 0)
+    {
+      for (cnt = 0; cnt < USE_RWLOCK_SpinCount && w.state == RWL_Q_WAITING; cnt++)
+	YieldProcessor();
+    }
+    r = 0;
+    if (InterlockedCompareExchange(&w.state, RWL_Q_PARKED, RWL_Q_WAITING) == RWL_Q_WAITING)
+    {
+      /* The tick count only serves waits which have to go on.  */
+      if (!ts && rel != INFINITE)
+	t0 = GetTickCount();
+      for (;;)
+      {
+	r = do_sema_b_wait_intern(w.ev, 2, timeout);
+	if ((r == 0 && w.state == RWL_Q_GRANTED) || (r != 0 && r != ETIMEDOUT))
+	  break;
+	/* Woken up for nothing, or a little before the time is up, by
+	   the timer resolution.  */
+	if (ts)
+	  timeout = dwMilliSecs(_pthread_clock_rel_time_in_ms(CLOCK_REALTIME, ts));
+	else if (rel != INFINITE)
+	{
+	  dt = GetTickCount() - t0;
+	  timeout = (dt < rel ? rel - dt : 0);
+	}
+	if (r != 0 && timeout == 0)
+	  break;
+      }
+      if (r != 0)
+      {
+	if (rwlock_unqueue(rwlock, &w) != 0)
+	  return r;
+	/* Granted too late, the lock counts.  The grant sets the event.  */
+	WaitForSingleObject(w.ev, INFINITE);
+	r = 0;
+      }
+    }
+    if (!shared)
+      rwlock->writer = GetCurrentThreadId();
+    return r;
+}
+
+static int
+rwlock_lock(pthread_rwlock_t *rwlock_, int shared, const struct timespec *ts, DWORD rel)
+{
+    rwlock_t *rwlock;
+    int ret;
+
+    if ((rwlock = rwlock_plain(rwlock_)) != NULL
+	&& (ret = rwlock_try(rwlock, shared)) != EBUSY)
+      return ret;
+    if ((ret = rwl_ref(rwlock_, 0)) != 0)
+      return ret;
+    ret = rwl_unref(rwlock_, rwlock_wait((rwlock_t *)*rwlock_, shared, ts, rel));
+    /* Acted on once the rwlock isn't busy anymore.  */
+    if (ret == EINVAL)
+      pthread_testcancel();
+    return ret;
+}
+
+static int
+rwlock_trylock(pthread_rwlock_t *rwlock_, int shared)
+{
+    rwlock_t *rwlock;
+    int ret;
+
+    if ((rwlock = rwlock_plain(rwlock_)) != NULL)
+      return rwlock_try(rwlock, shared);
+    if ((ret = rwl_ref(rwlock_, RWL_TRY)) != 0)
+      return ret;
+    return rwl_unref(rwlock_, rwlock_try((rwlock_t *)*rwlock_, shared));
+}
+
+/* Drops the caller's hold, and hands the lock on if it was the last
+   one and threads are queued.  Once the hold is gone the lock may be
+   taken, released and destroyed by others, without a reference, so
+   releasing qlock is the last access to it, see
+   pthread_rwlock_destroy.  */
+static int
+rwlock_release(rwlock_t *rwlock)
+{
+    rwlock_waiter *g;
+    LONG s, d;
+
+    if ((rwlock->state & RWL_WRITER) != 0 && rwlock->writer == GetCurrentThreadId())
+    {
+      rwlock->writer = 0;
+      if (InterlockedCompareExchange(&rwlock->state, 0, RWL_WRITER) == RWL_WRITER)
+	return 0;
+      d = -RWL_WRITER;
+    }
+    else
+    {
+      for (;;)
+      {
+	s = rwlock->state;
+	if ((s & RWL_READERS) == 0)
+	  return EPERM;
+	if ((s & RWL_WAITING) != 0 && (s & RWL_READERS) == 1)
+	  break;
+	if (InterlockedCompareExchange(&rwlock->state, s - 1, s) == s)
+	  return 0;
+      }
+      d = -1;
+    }
+    rwlock_qlock(rwlock);
+    InterlockedExchangeAdd(&rwlock->state, d);
+    g = rwlock_grant(rwlock);
+    rwlock_qunlock(rwlock);
+    rwlock_wake(g);
+    return 0;
+}
+
+int pthread_rwlock_init (pthread_rwlock_t *rwlock_, const pthread_rwlockattr_t *attr)
+{
+    rwlock_t *rwlock;
+
+    if(!rwlock_)
+      return EINVAL;
+    if (attr && *attr == PTHREAD_PROCESS_SHARED)
+      return _pshared_rwlock_init(rwlock_);
+    *rwlock_ = NULL;
+    if ((rwlock = (pthread_rwlock_t)calloc(1, sizeof(*rwlock))) == NULL)
+      return ENOMEM; 
+    rwlock->valid = LIFE_RWLOCK;
+    *rwlock_ = rwlock;
+    return 0;
+}
+
+int pthread_rwlock_destroy (pthread_rwlock_t *rwlock_)
+{
+    rwlock_t *rwlock;
+    pthread_rwlock_t rDestroy;
+    int r;
+
+    if (RWL_PSHARED(rwlock_))
+      return _pshared_rwlock_destroy(rwlock_);
+    r = rwl_ref_destroy(rwlock_,&rDestroy);
+
+    if(r) return r;
+    if(!rDestroy) return 0; /* destroyed a (still) static initialized rwl */
+
+    rwlock = (rwlock_t *)rDestroy;
+    /* Fails while held or waited for, else locks it for good.  */
+    if (InterlockedCompareExchange(&rwlock->state, RWL_WRITER, 0) != 0)
+    {
+      *rwlock_ = rDestroy;
+      return EBUSY;
+    }
+    /* The last unlock may still be on its way out, with qlock held.  */
+    while (rwlock->qlock != 0)
+      YieldProcessor();
+    rwlock->valid  = DEAD_RWLOCK;
+    free(rDestroy);
+    return 0;
+}
+
+int pthread_rwlock_rdlock (pthread_rwlock_t *rwlock_)
+{
+  pthread_testcancel();
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_rdlock(rwlock_, NULL);
+  return rwlock_lock(rwlock_, 1, NULL, INFINITE);
+}
+
+int pthread_rwlock_timedrdlock (pthread_rwlock_t *rwlock_, const struct timespec *ts)
+{
+  pthread_testcancel();
+  if (!rwlock_ || !ts)
+    return EINVAL;
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_rdlock(rwlock_, ts);
+  return rwlock_lock(rwlock_, 1, ts, INFINITE);
+}
+
+int pthread_rwlock_tryrdlock (pthread_rwlock_t *rwlock_)
+{
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_tryrdlock(rwlock_);
+  return rwlock_trylock(rwlock_, 1);
+}
+
+int pthread_rwlock_trywrlock (pthread_rwlock_t *rwlock_)
+{
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_trywrlock(rwlock_);
+  return rwlock_trylock(rwlock_, 0);
+}
+
+int pthread_rwlock_unlock (pthread_rwlock_t *rwlock_)
+{
+  rwlock_t *rwlock;
+  int ret;
+
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_unlock(rwlock_);
+  if ((rwlock = rwlock_plain(rwlock_)) != NULL)
+    return rwlock_release(rwlock);
+  ret = rwl_ref_unlock(rwlock_);
+  if(ret != 0) return ret;
+  return rwl_unref(rwlock_, rwlock_release((rwlock_t *)*rwlock_));
+}
+
+int pthread_rwlock_wrlock (pthread_rwlock_t *rwlock_)
+{
+  pthread_testcancel();
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_wrlock(rwlock_, NULL);
+  return rwlock_lock(rwlock_, 0, NULL, INFINITE);
+}
+
+int pthread_rwlock_timedwrlock (pthread_rwlock_t *rwlock_, const struct timespec *ts)
+{
+  pthread_testcancel();
+  if (!rwlock_ || !ts)
     return EINVAL;
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_wrlock(rwlock_, ts);
+  return rwlock_lock(rwlock_, 0, ts, INFINITE);
+}
+
+/* Like the timed locks, for the relative time rel, without reading the
+   clock first.  */
+int pthread_rwlock_reltimedrdlock_np (pthread_rwlock_t *rwlock_, const struct timespec *rel)
+{
+  struct timespec ts;
+
+  if (!rel)
+    return pthread_rwlock_rdlock(rwlock_);
+  pthread_testcancel();
+  if (RWL_PSHARED(rwlock_))
+  {
+    _pthread_abs_timespec(rel, &ts);
+    return _pshared_rwlock_rdlock(rwlock_, &ts);
   }
-  r = pthread_rwlock_init (rw, NULL);
-  _spin_lite_unlock(&cond_locked);
-  
+  return rwlock_lock(rwlock_, 1, NULL, dwMilliSecs(_pthread_rel_timespec_in_ms(rel)));
+}
+
+int pthread_rwlock_reltimedwrlock_np (pthread_rwlock_t *rwlock_, const struct timespec *rel)
+{
+  struct timespec ts;
+
+  if (!rel)
+    return pthread_rwlock_wrlock(rwlock_);
+  pthread_testcancel();
+  if (RWL_PSHARED(rwlock_))
+  {
+    _pthread_abs_timespec(rel, &ts);
+    return _pshared_rwlock_wrlock(rwlock_, &ts);
+  }
+  return rwlock_lock(rwlock_, 0, NULL, dwMilliSecs(_pthread_rel_timespec_in_ms(rel)));
+}
+
+#elif defined USE_RWLOCK_SRWLock
+/* Slim reader/writer locks of Windows.  An unlock has to know whether
+   it releases shared or exclusive access, hence readers and writer.
+   They can't be acquired with a timeout, so timed waiters sleep on ev,
+   which unlocks set while there are any, and try again.  */
+static HANDLE rwlock_srw_event(rwlock_t *rwlock)
+{
+  HANDLE ev;
+
+  if ((ev = rwlock->ev) != NULL)
+    return ev;
+  if ((ev = CreateEvent(NULL, 0, 0, NULL)) == NULL)
+    return NULL;
+  if (InterlockedCompareExchangePointer(&rwlock->ev, ev, NULL) != NULL)
+  {
+    CloseHandle(ev);
+    ev = rwlock->ev;
+  }
+  return ev;
+}
+
+static int rwlock_srw_timedlock(rwlock_t *rwlock, const struct timespec *ts, int shared)
+{
+  HANDLE ev = rwlock_srw_event(rwlock);
+  DWORD dw;
+  int r = 0;
+
+  InterlockedIncrement(&rwlock->timed);
+  while (!(shared ? TryAcquireSRWLockShared(&rwlock->l) : TryAcquireSRWLockExclusive(&rwlock->l)))
+  {
+    if ((dw = dwMilliSecs(_pthread_rel_time_in_ms(ts))) == 0)
+    {
+      r = ETIMEDOUT;
+      break;
+    }
+    if (ev)
+      WaitForSingleObject(ev, dw);
+    else
+      Sleep(1);
+  }
+  /* The event wakes a single waiter, so pass it on to other readers.  */
+  if (r == 0 && shared && rwlock->timed > 1 && ev)
+    SetEvent(ev);
+  InterlockedDecrement(&rwlock->timed);
   return r;
 }
 
+#define rwlock_srw_rdlocked(rw)	InterlockedIncrement(&(rw)->readers)
+#define rwlock_srw_wrlocked(rw)	((rw)->writer = GetCurrentThreadId())
+#define rwlock_srw_unlocked(rw)	((rw)->timed > 0 && (rw)->ev ? (void) SetEvent((rw)->ev) : (void) 0)
+
+int pthread_rwlock_init (pthread_rwlock_t *rwlock_, const pthread_rwlockattr_t *attr)
+{
+    rwlock_t *rwlock;
+
+    if(!rwlock_)
+      return EINVAL;
+    if (attr && *attr == PTHREAD_PROCESS_SHARED)
+      return _pshared_rwlock_init(rwlock_);
+    *rwlock_ = NULL;
+    if ((rwlock = (pthread_rwlock_t)calloc(1, sizeof(*rwlock))) == NULL)
+      return ENOMEM; 
+    InitializeSRWLock(&rwlock->l);
+    rwlock->valid = LIFE_RWLOCK;
+    *rwlock_ = rwlock;
+    return 0;
+}
+
+int pthread_rwlock_destroy (pthread_rwlock_t *rwlock_)
+{
+    rwlock_t *rwlock;
+    pthread_rwlock_t rDestroy;
+    int r;
+
+    if (RWL_PSHARED(rwlock_))
+      return _pshared_rwlock_destroy(rwlock_);
+    r = rwl_ref_destroy(rwlock_,&rDestroy);
+
+    if(r) return r;
+    if(!rDestroy) return 0; /* destroyed a (still) static initialized rwl */
+
+    rwlock = (rwlock_t *)rDestroy;
+    if (!TryAcquireSRWLockExclusive(&rwlock->l))
+    {
+      *rwlock_ = rDestroy;
+      return EBUSY;
+    }
+    ReleaseSRWLockExclusive(&rwlock->l);
+    rwlock->valid  = DEAD_RWLOCK;
+    if (rwlock->ev)
+      CloseHandle(rwlock->ev);
+    free(rDestroy);
+    return 0;
+}
+
+int pthread_rwlock_rdlock (pthread_rwlock_t *rwlock_)
+{
+  rwlock_t *rwlock;
+  int ret;
+
+  pthread_testcancel();
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_rdlock(rwlock_, NULL);
+  ret = rwl_ref(rwlock_,0);
+  if(ret != 0) return ret;
+
+  rwlock = (rwlock_t *)*rwlock_;
+  AcquireSRWLockShared(&rwlock->l);
+  rwlock_srw_rdlocked(rwlock);
+  return rwl_unref(rwlock_, 0);
+}
+
+int pthread_rwlock_timedrdlock (pthread_rwlock_t *rwlock_, const struct timespec *ts)
+{
+  rwlock_t *rwlock;
+  int ret;
+
+  pthread_testcancel();
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_rdlock(rwlock_, ts);
+  ret = rwl_ref(rwlock_,0);
+  if(ret != 0) return ret;
+
+  rwlock = (rwlock_t *)*rwlock_;
+  if ((ret = rwlock_srw_timedlock(rwlock, ts, 1)) == 0)
+    rwlock_srw_rdlocked(rwlock);
+  return rwl_unref(rwlock_, ret);
+}
+
+int pthread_rwlock_tryrdlock (pthread_rwlock_t *rwlock_)
+{
+  rwlock_t *rwlock;
+  int ret;
+
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_tryrdlock(rwlock_);
+  ret = rwl_ref(rwlock_,RWL_TRY);
+  if(ret != 0) return ret;
+
+  rwlock = (rwlock_t *)*rwlock_;
+  if (!TryAcquireSRWLockShared(&rwlock->l))
+    return rwl_unref(rwlock_, EBUSY);
+  rwlock_srw_rdlocked(rwlock);
+  return rwl_unref(rwlock_, 0);
+}
+
+int pthread_rwlock_trywrlock (pthread_rwlock_t *rwlock_)
+{
+  rwlock_t *rwlock;
+  int ret;
+
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_trywrlock(rwlock_);
+  ret = rwl_ref(rwlock_,RWL_TRY);
+  if(ret != 0) return ret;
+
+  rwlock = (rwlock_t *)*rwlock_;
+  if (!TryAcquireSRWLockExclusive(&rwlock->l))
+    return rwl_unref(rwlock_, EBUSY);
+  rwlock_srw_wrlocked(rwlock);
+  return rwl_unref(rwlock_, 0);
+}
+
+int pthread_rwlock_unlock (pthread_rwlock_t *rwlock_)
+{
+  rwlock_t *rwlock;
+  LONG n;
+  int ret;
+
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_unlock(rwlock_);
+  ret = rwl_ref_unlock(rwlock_);
+  if(ret != 0) return ret;
+
+  rwlock = (rwlock_t *)*rwlock_;
+  if (rwlock->writer == GetCurrentThreadId())
+  {
+    rwlock->writer = 0;
+    ReleaseSRWLockExclusive(&rwlock->l);
+    rwlock_srw_unlocked(rwlock);
+    return rwl_unref(rwlock_, 0);
+  }
+  /* Releasing an SRW lock nobody holds corrupts it.  */
+  do {
+    if ((n = rwlock->readers) == 0)
+      return rwl_unref(rwlock_, EPERM);
+  } while (InterlockedCompareExchange(&rwlock->readers, n - 1, n) != n);
+  ReleaseSRWLockShared(&rwlock->l);
+  rwlock_srw_unlocked(rwlock);
+  return rwl_unref(rwlock_, 0);
+}
+
+int pthread_rwlock_wrlock (pthread_rwlock_t *rwlock_)
+{
+  rwlock_t *rwlock;
+  int ret;
+
+  pthread_testcancel();
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_wrlock(rwlock_, NULL);
+  ret = rwl_ref(rwlock_,0);
+  if(ret != 0) return ret;
+
+  rwlock = (rwlock_t *)*rwlock_;
+  AcquireSRWLockExclusive(&rwlock->l);
+  rwlock_srw_wrlocked(rwlock);
+  return rwl_unref(rwlock_, 0);
+}
+
+int pthread_rwlock_timedwrlock (pthread_rwlock_t *rwlock_, const struct timespec *ts)
+{
+  rwlock_t *rwlock;
+  int ret;
+
+  pthread_testcancel();
+  if (!rwlock_ || !ts)
+    return EINVAL;
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_wrlock(rwlock_, ts);
+  if ((ret = rwl_ref(rwlock_,0)) != 0)
+    return ret;
+
+  rwlock = (rwlock_t *)*rwlock_;
+  if ((ret = rwlock_srw_timedlock(rwlock, ts, 0)) == 0)
+    rwlock_srw_wrlocked(rwlock);
+  return rwl_unref(rwlock_, ret);
+}
+
+#else /* USE_RWLOCK_pthread_cond */
 int pthread_rwlock_init (pthread_rwlock_t *rwlock_, const pthread_rwlockattr_t *attr)
 {
     rwlock_t *rwlock;
@@ -150,6 +831,8 @@ int pthread_rwlock_init (pthread_rwlock_t *rwlock_, const pthread_rwlockattr_t *
 
     if(!rwlock_)
       return EINVAL;
+    if (attr && *attr == PTHREAD_PROCESS_SHARED)
+      return _pshared_rwlock_init(rwlock_);
     *rwlock_ = NULL;
     if ((rwlock = (pthread_rwlock_t)calloc(1, sizeof(*rwlock))) == NULL)
       return ENOMEM; 
@@ -185,9 +868,9 @@ int pthread_rwlock_destroy (pthread_rwlock_t *rwlock_)
     pthread_rwlock_t rDestroy;
     int r, r2;
     
-    _spin_lite_lock(&cond_locked);
+    if (RWL_PSHARED(rwlock_))
+      return _pshared_rwlock_destroy(rwlock_);
     r = rwl_ref_destroy(rwlock_,&rDestroy);
-    _spin_lite_unlock(&cond_locked);
     
     if(r) return r;
     if(!rDestroy) return 0; /* destroyed a (still) static initialized rwl */
@@ -227,6 +910,8 @@ int pthread_rwlock_rdlock (pthread_rwlock_t *rwlock_)
   int ret;
 
   pthread_testcancel();
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_rdlock(rwlock_, NULL);
 
   ret = rwl_ref(rwlock_,0);
   if(ret != 0) return ret;
@@ -259,6 +944,8 @@ int pthread_rwlock_timedrdlock (pthread_rwlock_t *rwlock_, const struct timespec
   int ret;
 
   pthread_testcancel();
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_rdlock(rwlock_, ts);
 
   ret = rwl_ref(rwlock_,0);
   if(ret != 0) return ret;
@@ -291,6 +978,8 @@ int pthread_rwlock_tryrdlock (pthread_rwlock_t *rwlock_)
   rwlock_t *rwlock;
   int ret;
 
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_tryrdlock(rwlock_);
   ret = rwl_ref(rwlock_,RWL_TRY);
   if(ret != 0) return ret;
 
@@ -321,6 +1010,8 @@ int pthread_rwlock_trywrlock (pthread_rwlock_t *rwlock_)
   rwlock_t *rwlock;
   int ret;
 
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_trywrlock(rwlock_);
   ret = rwl_ref(rwlock_,RWL_TRY);
   if(ret != 0) return ret;
 
@@ -359,6 +1050,8 @@ int pthread_rwlock_unlock (pthread_rwlock_t *rwlock_)
   rwlock_t *rwlock;
   int ret;
 
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_unlock(rwlock_);
   ret = rwl_ref_unlock(rwlock_);
   if(ret != 0) return ret;
 
@@ -400,6 +1093,8 @@ int pthread_rwlock_wrlock (pthread_rwlock_t *rwlock_)
   int ret;
 
   pthread_testcancel();
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_wrlock(rwlock_, NULL);
   ret = rwl_ref(rwlock_,0);
   if(ret != 0) return ret;
 
@@ -441,6 +1136,8 @@ int pthread_rwlock_timedwrlock (pthread_rwlock_t *rwlock_, const struct timespec
   pthread_testcancel();
   if (!rwlock_ || !ts)
     return EINVAL;
+  if (RWL_PSHARED(rwlock_))
+    return _pshared_rwlock_wrlock(rwlock_, ts);
   if ((ret = rwl_ref(rwlock_,0)) != 0)
     return ret;
   rwlock = (rwlock_t *)*rwlock_;
@@ -478,6 +1175,31 @@ int pthread_rwlock_timedwrlock (pthread_rwlock_t *rwlock_, const struct timespec
     InterlockedIncrement((long*)&rwlock->nex_count);
   return rwl_unref(rwlock_,ret);
 }
+#endif
+
+#if !defined USE_RWLOCK_Atomic
+/* Like the timed locks, for the relative time rel.  Their deadline
+   holds across several waits, so rel is made absolute once.  */
+int pthread_rwlock_reltimedrdlock_np (pthread_rwlock_t *rwlock_, const struct timespec *rel)
+{
+  struct timespec ts;
+
+  if (!rel)
+    return pthread_rwlock_rdlock(rwlock_);
+  _pthread_abs_timespec(rel, &ts);
+  return pthread_rwlock_timedrdlock(rwlock_, &ts);
+}
+
+int pthread_rwlock_reltimedwrlock_np (pthread_rwlock_t *rwlock_, const struct timespec *rel)
+{
+  struct timespec ts;
+
+  if (!rel)
+    return pthread_rwlock_wrlock(rwlock_);
+  _pthread_abs_timespec(rel, &ts);
+  return pthread_rwlock_timedwrlock(rwlock_, &ts);
+}
+#endif
 
 int pthread_rwlockattr_destroy(pthread_rwlockattr_t *a)
 {
@@ -4,16 +4,66 @@
 #define LIFE_RWLOCK 0xBAB1F0ED
 #define DEAD_RWLOCK 0xDEADB0EF
 
-#undef USE_RWLOCK_SRWLock
-#undef USE_RWLOCK_pthread_cond
-#define USE_RWLOCK_pthread_cond 1
+/* The implementation is picked in pthread.h.  */
+#if !defined USE_RWLOCK_SRWLock && !defined USE_RWLOCK_pthread_cond && !defined USE_RWLOCK_Atomic
+#define USE_RWLOCK_Atomic 1
+#endif
 
 #define INIT_RWLOCK(rwl)  { int r; \
-    if (STATIC_RWL_INITIALIZER(*rwl)) { if ((r = rwlock_static_init(rwl))) { if (r != EBUSY) return r; }}}
+    if (!(rwl)) return EINVAL; \
+    if (STATIC_OR_NULL(*rwl)) { if ((r = rwlock_static_init(rwl))) { if (r != EBUSY) return r; }}}
+
+/* Process-shared rwlocks are handled by src/pshared.c.  */
+#define RWL_PSHARED(rwl)	((rwl) && PSHARED_P(*(rwl)))
 
 #define STATIC_RWL_INITIALIZER(x)		((pthread_rwlock_t)(x) == ((pthread_rwlock_t)PTHREAD_RWLOCK_INITIALIZER))
 
 typedef struct rwlock_t rwlock_t;
+#if defined USE_RWLOCK_Atomic
+/* The lock is the word state: the number of readers holding it, plus
+   RWL_WRITER while a writer holds it and RWL_WAITING while threads are
+   queued.  Uncontended locks and unlocks are one compare-and-swap on
+   it.  A thread that has to wait queues up a waiter on its stack and
+   sleeps on its park event.  Unlocks hand the lock on in FIFO order,
+   to the first waiter if it is a writer, or to all readers before the
+   next writer, and new readers queue up while RWL_WAITING is set, so
+   writers don't starve.  */
+#define RWL_READERS	0x1fffffff
+#define RWL_WAITING	0x20000000
+#define RWL_WRITER	0x40000000
+
+#define RWL_Q_WAITING	0	/* spinning on its waiter */
+#define RWL_Q_PARKED	1	/* blocked on its park event */
+#define RWL_Q_GRANTED	2	/* holds the lock now */
+
+typedef struct rwlock_waiter rwlock_waiter;
+struct rwlock_waiter {
+    rwlock_waiter *next;
+    volatile LONG state;
+    HANDLE ev;
+    int shared;
+    int queued; /* until dequeued by a grant, guarded by qlock */
+};
+
+struct rwlock_t {
+    unsigned int valid;
+    int busy;
+    volatile LONG state;
+    DWORD writer; /* Exclusive holder, to tell unlocks apart.  */
+    volatile LONG qlock; /* guards the waiter queue and RWL_WAITING */
+    rwlock_waiter *qhead, *qtail;
+};
+#elif defined USE_RWLOCK_SRWLock
+struct rwlock_t {
+    unsigned int valid;
+    int busy;
+    SRWLOCK l;
+    volatile LONG readers; /* Shared holders, to tell unlocks apart.  */
+    DWORD writer; /* Exclusive holder.  */
+    volatile LONG timed; /* Timed waiters, see rwlock_srw_timedlock.  */
+    HANDLE ev; /* Set by unlocks for them, created by the first one.  */
+};
+#else /* USE_RWLOCK_pthread_cond */
 struct rwlock_t {
     unsigned int valid;
     int busy;
@@ -24,6 +74,7 @@ struct rwlock_t {
     pthread_mutex_t mcomplete; /* Shared completed protection. */
     pthread_cond_t ccomplete; /* Shared access completed queue.  */
 };
+#endif
 
 #define RWL_SET	0x01
 #define RWL_TRY	0x02
@@ -7,6 +7,7 @@
 #include "sem.h"
 #include "mutex.h"
 #include "ref.h"
+#include "pshared.h"
 
 int do_sema_b_wait_intern (HANDLE sema, int nointerrupt, DWORD timeout);
 
@@ -27,7 +28,7 @@ int sem_init(sem_t *sem, int pshared, unsigned int value)
   if (!sem || value > (unsigned int)SEM_VALUE_MAX)
     return sem_result(EINVAL);
   if (pshared != PTHREAD_PROCESS_PRIVATE)
-    return sem_result(EPERM);
+    return sem_result(_pshared_sem_init(sem, value));
 
   if (!(sv = (sem_t)calloc(1,sizeof(*sv))))
     return sem_result(ENOMEM); 
@@ -56,6 +57,8 @@ int sem_destroy(sem_t *sem)
 
   if (!sem || (sv = *sem) == NULL)
     return sem_result(EINVAL);
+  if (PSHARED_P(sv))
+    return sem_result(_pshared_sem_destroy(sem));
   if (sem_result(pthread_mutex_lock(&sv->vlock)) != 0)
     return -1;
   if (sv->value < 0)
@@ -99,6 +102,8 @@ static int sem_std_enter(sem_t *sem,_sem_t **svp)
 int sem_trywait(sem_t *sem)
 {
   _sem_t *sv;
+  if (SEM_PSHARED(sem))
+    return sem_result(_pshared_sem_trywait(sem));
   if (sem_std_enter (sem, &sv) != 0)
     return -1;
   if (sv->value <= 0)
@@ -117,6 +122,8 @@ int sem_wait(sem_t *sem)
   int cur_v;
   _sem_t *sv;;
 
+  if (SEM_PSHARED(sem))
+    return sem_result(_pshared_sem_wait(sem, NULL));
   if (sem_std_enter (sem, &sv) != 0)
     return -1;
   InterlockedDecrement((long *)&sv->value);
@@ -142,16 +149,13 @@ int sem_wait(sem_t *sem)
   return sem_result(cur_v);
 }
 
-int sem_timedwait(sem_t *sem, const struct timespec *t)
+/* Waits for at most dwr milliseconds.  */
+static int
+sem_wait_ms(sem_t *sem, DWORD dwr)
 {
   int cur_v;
-  DWORD dwr;
   _sem_t *sv;;
 
-  if (!t)
-    return sem_wait(sem);
-  dwr = dwMilliSecs(_pthread_rel_time_in_ms(t));
-
   if (sem_std_enter (sem, &sv) != 0)
     return -1;
 
@@ -177,10 +181,37 @@ int sem_timedwait(sem_t *sem, const struct timespec *t)
   return sem_result(cur_v);
 }
 
+int sem_timedwait(sem_t *sem, const struct timespec *t)
+{
+  if (!t)
+    return sem_wait(sem);
+  if (SEM_PSHARED(sem))
+    return sem_result(_pshared_sem_wait(sem, t));
+  return sem_wait_ms(sem, dwMilliSecs(_pthread_rel_time_in_ms(t)));
+}
+
+/* Like sem_timedwait, but waits for the relative time rel, without
+   reading the clock.  */
+int sem_reltimedwait_np(sem_t *sem, const struct timespec *rel)
+{
+  struct timespec t;
+
+  if (!rel)
+    return sem_wait(sem);
+  if (SEM_PSHARED(sem))
+  {
+    _pthread_abs_timespec(rel, &t);
+    return sem_result(_pshared_sem_wait(sem, &t));
+  }
+  return sem_wait_ms(sem, dwMilliSecs(_pthread_rel_timespec_in_ms(rel)));
+}
+
 int sem_post(sem_t *sem)
 {
   _sem_t *sv;;
 
+  if (SEM_PSHARED(sem))
+    return sem_result(_pshared_sem_post(sem, 1));
   if (sem_std_enter (sem, &sv) != 0)
     return -1;
 
@@ -210,6 +241,8 @@ int sem_post_multiple(sem_t *sem, int count)
   int waiters_count;
   _sem_t *sv;;
 
+  if (SEM_PSHARED(sem))
+    return sem_result(_pshared_sem_post(sem, count));
   if (sem_std_enter (sem, &sv) != 0)
     return -1;
 
@@ -254,6 +287,8 @@ int sem_unlink(const char *name)
 int sem_getvalue(sem_t *sem, int *sval)
 {
   _sem_t *sv;;
+  if (SEM_PSHARED(sem))
+    return sem_result(_pshared_sem_getvalue(sem, sval));
   if (sem_std_enter (sem, &sv) != 0)
     return -1;
 
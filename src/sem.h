@@ -7,6 +7,9 @@
 #define LIFE_SEM 0xBAB1F00D
 #define DEAD_SEM 0xDEADBEEF
 
+/* Process-shared semaphores are handled by src/pshared.c.  */
+#define SEM_PSHARED(s)	((s) && PSHARED_P(*(s)))
+
 typedef struct _sem_t _sem_t;
 struct _sem_t
 {
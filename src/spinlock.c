@@ -3,30 +3,116 @@
 #include "pthread.h"
 #include "spinlock.h"
 #include "misc.h"
+#include "pshared.h"
       
-static int scnt = 0;
-static LONG bscnt = 0;
-static int scntMax = 0;
+/* Contention statistics, see pthread_spin_setstats_np.  While they are
+   off, the lock paths and the inline fast paths just test spin_stats_on.  The list lock has no
+   name, so it keeps no statistics of itself.  */
+volatile LONG _pthread_spin_stats_on = 0;
+#define spin_stats_on		_pthread_spin_stats_on
+static spin_t spin_stats_lock = SPIN_LITE_INITIALIZER(NULL);
+static spin_stats *spin_stats_list = NULL;
 
-static spin_t spin_locked = {0,LIFE_SPINLOCK,0};
+/* Returns the statistics of the lock, attaching them at first use.  */
+static __attribute__((noinline)) spin_stats *
+spin_stats_ref(spin_t *_l, pthread_spinlock_t *l)
+{
+    spin_stats *st = _l->stats;
+
+    if (st != NULL)
+      return st;
+    if ((st = (spin_stats *) calloc(1, sizeof(*st))) == NULL)
+      return NULL;
+    st->l = l;
+    st->name = _l->name;
+    if (InterlockedCompareExchangePointer((void **) &_l->stats, st, NULL) != NULL)
+    {
+      free(st);
+      return _l->stats;
+    }
+    _spin_lite_lock(&spin_stats_lock);
+    if ((st->next = spin_stats_list) != NULL)
+      st->next->prev = st;
+    spin_stats_list = st;
+    _spin_lite_unlock(&spin_stats_lock);
+    return st;
+}
+
+static void
+spin_stats_detach(spin_t *_l)
+{
+    spin_stats *st = _l->stats;
+
+    if (st == NULL)
+      return;
+    _l->stats = NULL;
+    _spin_lite_lock(&spin_stats_lock);
+    if (st->prev)
+      st->prev->next = st->next;
+    else
+      spin_stats_list = st->next;
+    if (st->next)
+      st->next->prev = st->prev;
+    _spin_lite_unlock(&spin_stats_lock);
+    free(st);
+}
+
+/* Accounts an acquisition which took spins looks at the lock.  The
+   caller holds the lock.  */
+static void
+spin_stats_locked(spin_t *_l, pthread_spinlock_t *l, int spins)
+{
+    spin_stats *st;
+    pthread_spin_stats_np *s;
+
+    if ((st = spin_stats_ref(_l, l)) == NULL)
+      return;
+    s = &st->shard[SPIN_STATS_SHARD(GetCurrentThreadId())].s;
+    s->acquisitions++;
+    if (spins == 0)
+      return;
+    s->contended++;
+    s->spins += spins;
+    if ((unsigned long long) spins > s->spins_max)
+      s->spins_max = spins;
+}
+
+/* Sums up the shards.  */
+static void
+spin_stats_sum(spin_stats *st, pthread_spin_stats_np *s)
+{
+    int i;
 
+    memset(s, 0, sizeof(*s));
+    for (i = 0; i < SPIN_STATS_SHARDS; i++)
+    {
+      s->acquisitions += st->shard[i].s.acquisitions;
+      s->contended += st->shard[i].s.contended;
+      s->spins += st->shard[i].s.spins;
+      if (st->shard[i].s.spins_max > s->spins_max)
+	s->spins_max = st->shard[i].s.spins_max;
+    }
+}
 
-static inline int
+/* Initializes privately and publishes with a compare-and-swap over
+   the static initializer, the loser of a race frees its copy.  */
+static int
 spinlock_static_init (pthread_spinlock_t *l)
 {
+  pthread_spinlock_t nl = NULL;
   int ret;
-  _spin_lite_lock(&spin_locked);
+
   if (PTHREAD_SPINLOCK_INITIALIZER != *l)
   {
     /* Check that somebody called destroy already.  Otherwise assume someone crept in between.  */
-    ret = (*l == NULL ? EINVAL : 0);
-  }
-  else
-  {
-    ret = pthread_spin_init(l, PTHREAD_PROCESS_PRIVATE);
+    return (*l == NULL ? EINVAL : 0);
   }
-  _spin_lite_unlock(&spin_locked);
-  return ret;
+  ret = pthread_spin_init(&nl, PTHREAD_PROCESS_PRIVATE);
+  if (ret != 0)
+    return ret;
+  if (InterlockedCompareExchangePointer(l, nl, PTHREAD_SPINLOCK_INITIALIZER) != PTHREAD_SPINLOCK_INITIALIZER)
+    pthread_spin_destroy(&nl);
+  return 0;
 }
 
 int pthread_spin_init(pthread_spinlock_t *l, int pshared)
@@ -35,7 +121,7 @@ int pthread_spin_init(pthread_spinlock_t *l, int pshared)
     
     if (!l) return EINVAL; 
     if (pshared == PTHREAD_PROCESS_SHARED)
-      return ENOSYS;
+      return _pshared_spin_init(l);
     if (pshared != PTHREAD_PROCESS_SHARED && pshared != PTHREAD_PROCESS_PRIVATE) return EINVAL;
     if (!(_l = (pthread_spinlock_t)calloc(1, sizeof(*_l))))
         return ENOMEM;
@@ -49,125 +135,471 @@ int pthread_spin_destroy(pthread_spinlock_t *l)
 {
   spin_t *_l;
   if (!l || !*l) return EINVAL;
-  _spin_lite_lock(&spin_locked);
+  if (PSHARED_P(*l))
+    return _pshared_spin_destroy(l);
   if (*l == PTHREAD_SPINLOCK_INITIALIZER)
   {
-    *l = NULL;
-    _spin_lite_unlock(&spin_locked);
+    /* Fails if someone initializes it concurrently.  */
+    if (InterlockedCompareExchangePointer(l, NULL, PTHREAD_SPINLOCK_INITIALIZER) != PTHREAD_SPINLOCK_INITIALIZER)
+      return EBUSY;
     return 0;
   }
-  _spin_lite_unlock(&spin_locked);
   _l = (spin_t *)*l;
   if (((spin_t *)(*l))->valid != (unsigned int)LIFE_SPINLOCK)
     return EINVAL;
   
-  if (_l->l != 0)
+  if (SPIN_TICKET_BUSY(&_l->t))
     return EBUSY;
   *l= NULL; /* dereference first, free later */
   _l->valid  = DEAD_SPINLOCK;
-  _l->l = 0;
+  spin_stats_detach(_l);
   free(_l);
   return 0;
 }
 
-/* No-fair spinlock due to lack of knowledge of thread number.  */
+/* Threads ahead of the holder of ticket t.  */
+#define SPIN_TICKET_AHEAD(tk,t)	((LONG) ((ULONG) (t) - (ULONG) (tk)->serving))
+
+#ifdef USE_SPINLOCK_Hybrid
+/* Pauses spun before yielding, -1 until calibrated.  */
+static LONG spin_budget = -1;
+
+/* Times the pause instruction, whose latency differs a lot between
+   processors.  With one processor the holder can't make progress
+   while we spin, so don't.  */
+static LONG
+spin_calibrate(void)
+{
+  unsigned long long t, ns;
+  LONG n;
+  int i;
+
+  if (_pthread_num_cpus() == 1)
+    n = 0;
+  else
+  {
+    t = _pthread_ticks();
+    for (i = 0; i < 1000; i++)
+      YieldProcessor();
+    ns = _pthread_ticks_to_ns(_pthread_ticks() - t);
+    n = (ns ? (LONG) (1000ULL * 1000ULL * USE_SPINLOCK_HybridSpinUs / ns) : 100000);
+    if (n < 1)
+      n = 1;
+    else if (n > 100000)
+      n = 100000;
+  }
+  InterlockedExchange(&spin_budget, n);
+  return n;
+}
+
+/* One step of waiting for a spinlock, *cnt counts the steps so far
+   and starts at zero.  Returns nonzero if the step gave up the
+   processor, so the caller rechecks the lock at once.  Once spinning
+   and yielding didn't help, it returns SPIN_HYBRID_PARK instead if
+   park is set, and the caller sleeps until the lock is released.  */
+int _spin_hybrid_wait(int *cnt, int park)
+{
+  LONG budget = spin_budget;
+  int c = *cnt;
+
+  if (budget < 0)
+    budget = spin_calibrate();
+  if (c < budget)
+  {
+    *cnt = c + 1;
+    YieldProcessor();
+    return 0;
+  }
+  if (!park || c < budget + USE_SPINLOCK_HybridYields)
+  {
+    if (park)
+      *cnt = c + 1;
+    if (!SwitchToThread())
+      Sleep(0);
+    return 1;
+  }
+  /* The holder is off the processor for long.  */
+  return SPIN_HYBRID_PARK;
+}
+#endif
+
+/* Waits between two looks at serving.  A waiter far back in the queue
+   can't get the lock soon, so it stays off the cache line in
+   proportion to its position.  It gives up its time slice if it might
+   keep a thread ahead of it from running: when it is far back, or
+   when the queue didn't move for a while, as happens if the next
+   holder is preempted or there is just one processor.  */
+static void
+spin_ticket_backoff(LONG ahead, int *stalls)
+{
+  LONG i;
+
+  if (ahead > USE_SPINLOCK_YieldQueue)
+  {
+    Sleep(0);
+    return;
+  }
+#ifdef USE_SPINLOCK_Hybrid
+  /* Yield, but don't park: the lock is handed to the next in line,
+     and a sleeping waiter would hold up everybody behind it.  */
+  for (i = ahead * USE_SPINLOCK_BackoffStep; i > 0; i--)
+  {
+    if (_spin_hybrid_wait(stalls, 0))
+      break;
+  }
+#else
+  if (++*stalls > USE_SPINLOCK_YieldStalls)
+  {
+    Sleep(0);
+    return;
+  }
+  for (i = ahead * USE_SPINLOCK_BackoffStep; i > 0; i--)
+    YieldProcessor();
+#endif
+}
+
+/* *spins is set to the number of looks at the lock while waiting.  */
+int _spin_ticket_lock(spin_ticket_t *t, int *spins)
+{
+  LONG me, ahead, prev = 0;
+  int stalls = 0;
+
+  *spins = 0;
+  me = InterlockedIncrement(&t->next) - 1;
+  while ((ahead = SPIN_TICKET_AHEAD(t, me)) != 0)
+  {
+    ++*spins;
+    if (ahead != prev)
+      stalls = 0;
+    prev = ahead;
+    spin_ticket_backoff(ahead, &stalls);
+    /* Compiler barrier.  Prevent caching of serving.  */
+    _ReadWriteBarrier();
+  }
+  return 0;
+}
+
+/* Takes the next ticket only if it is served at once.  serving never
+   passes next, so next still equal to the serving value read before
+   means the lock is free.  */
+int _spin_ticket_trylock(spin_ticket_t *t)
+{
+  LONG s = t->serving;
+
+  if (InterlockedCompareExchange(&t->next, s + 1, s) != s)
+    return EBUSY;
+  return 0;
+}
+
+/* A ticket once drawn can't be given back, so the timed variant
+   polls with trylock instead of queuing.  It is bounded, not fair:
+   under steady contention it tends to time out.  */
+int _spin_ticket_timedlock(spin_ticket_t *t, const struct timespec *ts, int *spins)
+{
+  LONG ahead;
+  int cnt, stalls = 0;
+
+  if (!ts)
+    return EINVAL;
+  for (cnt = 0;; cnt++)
+  {
+    if (_spin_ticket_trylock(t) == 0)
+    {
+      *spins = cnt;
+      return 0;
+    }
+    if ((cnt & 15) == 0 && _pthread_rel_time_in_ms(ts) == 0)
+      return ETIMEDOUT;
+    ahead = (LONG) ((ULONG) t->next - (ULONG) t->serving);
+    spin_ticket_backoff(ahead > 0 ? ahead : 1, &stalls);
+    _ReadWriteBarrier();
+  }
+}
+
+int _spin_ticket_unlock(spin_ticket_t *t)
+{
+  LONG s = t->serving;
+
+  if (t->next == s)
+    return EPERM;
+  /* Compiler barrier.  The store below acts with release symmantics.  */
+  _ReadWriteBarrier();
+  t->serving = s + 1;
+  return 0;
+}
+
 int pthread_spin_lock(pthread_spinlock_t *l)
 {
   spin_t *_l;
+  int spins;
 
-  if (!l || *l == NULL)
+  if (!l)
     return EINVAL;
-  if (PTHREAD_SPINLOCK_INITIALIZER == *l)
+  if (STATIC_OR_NULL(*l))
   {
     int r = spinlock_static_init(l);
     if (r != 0)
       return r;
   }
+  else if (PSHARED_P(*l))
+    return _pshared_spin_lock(l);
   _l = (spin_t *)*l;
-  while (InterlockedExchange((long*)&_l->l, EBUSY) == EBUSY)
+  _spin_ticket_lock(&_l->t, &spins);
+  if (spin_stats_on)
+    spin_stats_locked(_l, l, spins);
+  return 0;
+}
+
+int pthread_spin_timedlock_np(pthread_spinlock_t *l, const struct timespec *ts)
+{
+  spin_t *_l;
+  int r, spins;
+
+  if (!l)
+    return EINVAL;
+  if (STATIC_OR_NULL(*l))
   {
-    YieldProcessor();
+    r = spinlock_static_init(l);
+    if (r != 0)
+      return r;
   }
-  return 0;
+  else if (PSHARED_P(*l))
+    return _pshared_spin_timedlock(l, ts);
+  _l = (spin_t *)*l;
+  r = _spin_ticket_timedlock(&_l->t, ts, &spins);
+  if (r == 0 && spin_stats_on)
+    spin_stats_locked(_l, l, spins);
+  return r;
 }
 
 int pthread_spin_trylock(pthread_spinlock_t *l)
 {
   spin_t *_l;
-  int r = 0;
-  if (!l || *l == NULL)
+  int r;
+
+  if (!l)
     return EINVAL;
-  if (PTHREAD_SPINLOCK_INITIALIZER == *l)
+  if (STATIC_OR_NULL(*l))
   {
     r = spinlock_static_init(l);
     if (r != 0)
       return r;
   }
+  else if (PSHARED_P(*l))
+    return _pshared_spin_trylock(l);
+  _l = (spin_t *)*l;
+  r = _spin_ticket_trylock(&_l->t);
+  if (r == 0 && spin_stats_on)
+    spin_stats_locked(_l, l, 0);
+  return r;
+}
+
+/* Turns the collection of contention statistics on or off for all
+   spinlocks.  Statistics are kept after turning them off.  */
+int pthread_spin_setstats_np(int enable)
+{
+  InterlockedExchange(&spin_stats_on, (enable != 0));
+  return 0;
+}
 
+int pthread_spin_getstats_np(pthread_spinlock_t *l, pthread_spin_stats_np *s)
+{
+  spin_t *_l;
+
+  if (!l || !s)
+    return EINVAL;
+  if (STATIC_OR_NULL(*l) || PSHARED_P(*l))
+  {
+    memset(s, 0, sizeof(*s));
+    return (*l == NULL || PSHARED_P(*l) ? EINVAL : 0);
+  }
   _l = (spin_t *)*l;
+  if (_l->valid != (unsigned int)LIFE_SPINLOCK)
+    return EINVAL;
+  if (_l->stats != NULL)
+    spin_stats_sum(_l->stats, s);
+  else
+    memset(s, 0, sizeof(*s));
+  return 0;
+}
 
-  r = InterlockedExchange(&_l->l, EBUSY);
+/* Calls func with the statistics of each live spinlock which has some,
+   until it returns non-zero.  It works on a snapshot, as with
+   pthread_mutex_enumstats_np.  */
+int pthread_spin_enumstats_np(int (*func)(pthread_spinlock_t *l, const char *name, const pthread_spin_stats_np *s, void *arg), void *arg)
+{
+  struct snap {
+      pthread_spinlock_t *l;
+      const char *name;
+      pthread_spin_stats_np s;
+  } *snap;
+  spin_stats *st;
+  size_t n = 0, i;
+
+  if (!func)
+    return EINVAL;
+  _spin_lite_lock(&spin_stats_lock);
+  for (st = spin_stats_list; st != NULL; st = st->next)
+    n++;
+  if ((snap = (struct snap *) malloc((n ? n : 1) * sizeof(*snap))) == NULL)
+  {
+    _spin_lite_unlock(&spin_stats_lock);
+    return ENOMEM;
+  }
+  for (i = 0, st = spin_stats_list; st != NULL; st = st->next, i++)
+  {
+    snap[i].l = st->l;
+    snap[i].name = st->name;
+    spin_stats_sum(st, &snap[i].s);
+  }
+  _spin_lite_unlock(&spin_stats_lock);
+
+  for (i = 0; i < n; i++)
+  {
+    if (func(snap[i].l, snap[i].name, &snap[i].s, arg) != 0)
+      break;
+  }
+  free(snap);
+  return 0;
+}
+
+/* Totals of the internal locks, for test/test.c.  */
+static unsigned long long
+spin_lite_total(int what, int reset)
+{
+  pthread_spin_stats_np s;
+  spin_stats *st;
+  unsigned long long r = 0;
+
+  _spin_lite_lock(&spin_stats_lock);
+  for (st = spin_stats_list; st != NULL; st = st->next)
+  {
+    if (st->l != NULL)
+      continue;
+    spin_stats_sum(st, &s);
+    if (what == 0)
+      r += s.spins;
+    else if (what == 1)
+      r += s.contended;
+    else if (s.spins_max > r)
+      r = s.spins_max;
+    if (reset)
+      memset(st->shard, 0, sizeof(st->shard));
+  }
+  _spin_lite_unlock(&spin_stats_lock);
   return r;
 }
 
 int _spin_lite_getsc(int reset)
 {
-    int r = scnt;
-    if (reset) scnt = 0;
-    return r;
+    return (int) spin_lite_total(0, reset);
 }
 
 int _spin_lite_getbsc(int reset)
 {
-    int r = bscnt;
-    if (reset) bscnt = 0;
-    return r;
+    return (int) spin_lite_total(1, reset);
 }
 
 int _spin_lite_getscMax(int reset)
 {
-    int r = scntMax;
-    if (reset) scntMax = 0;
-    return r;
+    return (int) spin_lite_total(2, reset);
 }
 
+#ifdef USE_SPINLOCK_Hybrid
+/* The event parked waiters of l sleep on, created at the first one.
+   Internal locks are never destroyed, neither is it.  */
+static HANDLE
+spin_lite_event(spin_t *l)
+{
+    HANDLE ev = l->ev;
+
+    if (ev != NULL)
+      return ev;
+    if ((ev = CreateEvent(NULL, 0, 0, NULL)) == NULL)
+      return NULL;
+    if (InterlockedCompareExchangePointer(&l->ev, ev, NULL) != NULL)
+    {
+      CloseHandle(ev);
+      return l->ev;
+    }
+    return ev;
+}
+
+/* Sleeps until l is released and takes it, returns the number of
+   wakeups.  The lock stays SPIN_LITE_PARKED, so that its unlock wakes
+   the next parked waiter, if there is one.  */
+static int
+spin_lite_park(spin_t *l)
+{
+    HANDLE ev = spin_lite_event(l);
+    int n = 0;
+
+    while (InterlockedExchange(&l->l, SPIN_LITE_PARKED) != SPIN_LITE_FREE)
+    {
+      n++;
+      /* Out of handles, yield instead.  */
+      if (ev == NULL)
+	Sleep(0);
+      else
+	WaitForSingleObject(ev, INFINITE);
+    }
+    return n;
+}
+#endif
+
 int _spin_lite_trylock(spin_t *l)
 {
     CHECK_SPINLOCK_LITE(l);
-    return InterlockedExchange(&l->l, EBUSY);
+    if (InterlockedCompareExchange(&l->l, SPIN_LITE_LOCKED, SPIN_LITE_FREE) != SPIN_LITE_FREE)
+      return EBUSY;
+    return 0;
 }
+
+/* Only wakes someone if a waiter parked.  */
 int _spin_lite_unlock(spin_t *l)
 {
     CHECK_SPINLOCK_LITE(l);
-    /* Compiler barrier.  The store below acts with release symmantics.  */
-    _ReadWriteBarrier();
-    l->l = 0;
-
+    if (InterlockedExchange(&l->l, SPIN_LITE_FREE) == SPIN_LITE_PARKED && l->ev != NULL)
+      SetEvent(l->ev);
     return 0;
 }
+
 int _spin_lite_lock(spin_t *l)
 {
     CHECK_SPINLOCK_LITE(l);
-    int lscnt = 0;
+    int lscnt = 0, parked = 0;
+#ifdef USE_SPINLOCK_Hybrid
+    int wcnt = 0;
+#endif
 
     _vol_spinlock v;
     v.l = (LONG *)&l->l;
-    _spin_lite_lock_inc(bscnt);
-    while (InterlockedExchange(v.lv, EBUSY))
+    while (InterlockedCompareExchange(v.lv, SPIN_LITE_LOCKED, SPIN_LITE_FREE) != SPIN_LITE_FREE)
     {
-        _spin_lite_lock_cnt(lscnt);
+        lscnt++;
         /* Don't lock the bus whilst waiting */
         while (*v.lv)
         {
-            _spin_lite_lock_cnt(lscnt);
+            lscnt++;
+#ifdef USE_SPINLOCK_Hybrid
+            if (_spin_hybrid_wait(&wcnt, 1) == SPIN_HYBRID_PARK)
+            {
+                lscnt += spin_lite_park(l);
+                parked = 1;
+                break;
+            }
+#else
             YieldProcessor();
+#endif
 
             /* Compiler barrier.  Prevent caching of *l */
             _ReadWriteBarrier();
         }
+        if (parked)
+            break;
     }
-    _spin_lite_lock_dec(bscnt);
-    _spin_lite_lock_stat(lscnt);
+    if (spin_stats_on && l->name != NULL)
+      spin_stats_locked(l, NULL, lscnt);
     return 0;
 }
 
@@ -175,15 +607,11 @@ int _spin_lite_lock(spin_t *l)
 int
 pthread_spin_unlock (pthread_spinlock_t *l)
 {
-  spin_t *_l;
-  int r;
   if (!l || *l == NULL)
     return EINVAL;
   if (*l == PTHREAD_SPINLOCK_INITIALIZER)
     return EPERM;
-  _l = (spin_t *)*l;
-
-  /* Compiler barrier.  The store below acts with release symmantics.  */
-  r = InterlockedExchange((long*)&_l->l, 0);
-  return (!r ? EPERM : 0);
+  if (PSHARED_P(*l))
+    return _pshared_spin_unlock(l);
+  return _spin_ticket_unlock(&((spin_t *)*l)->t);
 }
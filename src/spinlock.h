@@ -14,32 +14,90 @@
 
 #ifdef USE_SPINLOCK_DBG
 #define CHECK_SPINLOCK_LITE(l) if (!(l)) return EINVAL;
-#define _spin_lite_lock_cnt(c)	c++
-#define _spin_lite_lock_inc(c)	InterlockedIncrement(&c)
-#define _spin_lite_lock_dec(c)	InterlockedDecrement(&c)
-#define _spin_lite_lock_stat(c)	{scntMax = (c > scntMax) ? c : scntMax;	scnt += lscnt;}
 #else
 #define CHECK_SPINLOCK_LITE(l)
-#define _spin_lite_lock_cnt(c)
-#define _spin_lite_lock_inc(c)
-#define _spin_lite_lock_stat(c)
-#define _spin_lite_lock_dec(c)
 #endif
 
 #undef USE_SPINLOCK_EPERM
 #define CHECK_PERM_SL(l)
 
+/* Returned by _spin_hybrid_wait when the waiter should park.  */
+#define SPIN_HYBRID_PARK	2
+
 #define INIT_SPINLOCK(s)  { int r; \
-    if (PTHREAD_SPINLOCK_INITIALIZER == *s) { if ((r = spinlock_static_init(s))) return r; }}
+    if (STATIC_OR_NULL(*s)) { if ((r = spinlock_static_init(s))) return r; }}
+
+/* A ticket lock.  Waiters draw increasing tickets from next and enter
+   in order as serving reaches them; the lock is free while both are
+   equal.  The counters wrap, so compare only their difference.  */
+typedef struct spin_ticket_t spin_ticket_t;
+struct spin_ticket_t
+{
+    volatile LONG next;
+    volatile LONG serving;
+};
+
+#define SPIN_TICKET_BUSY(t)	((t)->next != (t)->serving)
+
+/* Contention statistics of a spinlock, attached at its first lock
+   while they are enabled, see pthread_spin_setstats_np.  Only the
+   holder updates them, in the shard of its thread, so consecutive
+   holders on different processors mostly write different lines.  */
+#define SPIN_STATS_SHARDS	8
+
+/* Thread ids are multiples of 4, the low bits would pick two shards.  */
+#define SPIN_STATS_SHARD(tid)	((unsigned) ((tid) >> 2) % SPIN_STATS_SHARDS)
+
+typedef struct spin_stats spin_stats;
+struct spin_stats
+{
+    union {
+	pthread_spin_stats_np s;
+	char pad[64];
+    } shard[SPIN_STATS_SHARDS];
+    pthread_spinlock_t *l;	/* NULL for internal locks */
+    const char *name;
+    spin_stats *prev, *next;
+};
+
+/* States of the lock word of internal locks.  */
+#define SPIN_LITE_FREE		0
+#define SPIN_LITE_LOCKED	1
+#define SPIN_LITE_PARKED	2	/* locked, and waiters may sleep on ev */
 
 typedef struct spin_t spin_t;
 struct spin_t
 {
     DWORD owner;
     unsigned int valid;   
-    LONG l;   
+    LONG l;   		/* _spin_lite_* */
+    spin_ticket_t t;	/* pthread_spin_* */
+    spin_stats *stats;
+    const char *name;	/* of internal locks with statistics */
+    HANDLE ev;		/* parked waiters of internal locks, see _spin_lite_lock */
 };
 
+/* Internal locks.  Statistics are kept for those with a name.  */
+#define SPIN_LITE_INITIALIZER(name)	{0,LIFE_SPINLOCK,0,{0,0},NULL,name,NULL}
+
+/* Internal locks guarding per-object state come in stripes, picked by
+   the address of the object, so threads working on unrelated objects
+   mostly take different locks on different cache lines.  */
+#define SPIN_STRIPES	16
+
+typedef struct spin_stripe spin_stripe;
+struct spin_stripe
+{
+    spin_t l;
+} __attribute__((aligned(64)));
+
+#define SPIN_STRIPES_INITIALIZER(name) \
+    { [0 ... SPIN_STRIPES - 1] = { SPIN_LITE_INITIALIZER(name) } }
+
+#define SPIN_STRIPE_INDEX(p) \
+    ((unsigned) (((uintptr_t)(p) >> 4) ^ ((uintptr_t)(p) >> 10)) % SPIN_STRIPES)
+#define SPIN_STRIPE(s, p)	(&(s)[SPIN_STRIPE_INDEX(p)].l)
+
 #define LIFE_SPINLOCK 0xFEEDBAB1
 #define DEAD_SPINLOCK 0xB00FDEAD
 
@@ -60,4 +118,11 @@ int _spin_lite_getbsc(int reset);
 
 int _spin_lite_getscMax(int reset);
 
+int _spin_hybrid_wait(int *cnt, int park);
+
+int _spin_ticket_lock(spin_ticket_t *t, int *spins);
+int _spin_ticket_timedlock(spin_ticket_t *t, const struct timespec *ts, int *spins);
+int _spin_ticket_trylock(spin_ticket_t *t);
+int _spin_ticket_unlock(spin_ticket_t *t);
+
 #endif
@@ -11,14 +11,16 @@ static int _pthread_concur;
 
 /* FIXME Will default to zero as needed */
 static pthread_once_t _pthread_tls_once;
-static DWORD _pthread_tls = 0xffffffff;
+DWORD _pthread_tls = 0xffffffff;	/* also used by pthread_inline.h */
 
 static pthread_rwlock_t _pthread_key_lock = PTHREAD_RWLOCK_INITIALIZER;
 static unsigned long _pthread_key_max=0L;
 static unsigned long _pthread_key_sch=0L;
 
 static _pthread_v *pthr_root = NULL, *pthr_last = NULL;
-static spin_t spin_pthr_locked = {0,LIFE_SPINLOCK,0};
+static spin_t spin_pthr_locked = SPIN_LITE_INITIALIZER("spin_pthr_locked");
+/* Copied into p_clock, as PTHREAD_MUTEX_INITIALIZER may be a struct initializer.  */
+static const pthread_mutex_t mutex_initializer = PTHREAD_MUTEX_INITIALIZER;
 
 static void push_pthread_mem(_pthread_v *sv)
 {
@@ -26,6 +28,10 @@ static void push_pthread_mem(_pthread_v *sv)
   if (!sv || sv->next != NULL)
     return;
   x = sv->x + 1;
+  if (sv->evPark)
+    CloseHandle (sv->evPark);
+  if (sv->hprio)
+    CloseHandle (sv->hprio);
   memset (sv, 0, sizeof(struct _pthread_v));
   _spin_lite_lock(&spin_pthr_locked);
   if (pthr_last == NULL)
@@ -164,15 +170,17 @@ typedef struct collect_once_t {
   struct collect_once_t *next;
 } collect_once_t;
 
-static collect_once_t *once_obj = NULL;
+/* One list per stripe of once_global, by the address of the once.  */
+static collect_once_t *once_obj[SPIN_STRIPES];
 
-static spin_t once_global = {0,LIFE_SPINLOCK,0};
+static spin_stripe once_global[SPIN_STRIPES] = SPIN_STRIPES_INITIALIZER("once_global");
 
 static collect_once_t *enterOnceObject(pthread_once_t *o)
 {
   collect_once_t *c, *p = NULL;
-  _spin_lite_lock(&once_global);
-  c = once_obj;
+  collect_once_t **h = &once_obj[SPIN_STRIPE_INDEX(o)];
+  _spin_lite_lock(SPIN_STRIPE(once_global, o));
+  c = *h;
   while (c != NULL && c->o != o)
   {
     c = (p = c)->next;
@@ -182,23 +190,26 @@ static collect_once_t *enterOnceObject(pthread_once_t *o)
     c = (collect_once_t *) calloc(1,sizeof(collect_once_t));
     c->o = o;
     c->count = 1;
-    if (!p) once_obj = c;
+    if (!p) *h = c;
     else p->next = c;
     pthread_mutex_init(&c->m, NULL);
   }
   else
     c->count += 1;
-  _spin_lite_unlock(&once_global);
+  _spin_lite_unlock(SPIN_STRIPE(once_global, o));
   return c;
 }
 
 static void leaveOnceObject(collect_once_t *c)
 {
-  collect_once_t *h, *p = NULL;
+  collect_once_t *h, *p = NULL, **l;
+  pthread_once_t *o;
   if (!c)
     return;
-  _spin_lite_lock(&once_global);
-  h = once_obj;
+  o = c->o;
+  l = &once_obj[SPIN_STRIPE_INDEX(o)];
+  _spin_lite_lock(SPIN_STRIPE(once_global, o));
+  h = *l;
   while (h != NULL && c != h)
   {
     h = (p = h)->next;
@@ -209,13 +220,13 @@ static void leaveOnceObject(collect_once_t *c)
     if (c->count == 0)
     {
       pthread_mutex_destroy(&c->m);
-      if (!p) once_obj = c->next;
+      if (!p) *l = c->next;
       else p->next = c->next;
       free (c);
     }
   }
   else fprintf(stderr, "%p not found?!?!\n", c);
-  _spin_lite_unlock(&once_global);
+  _spin_lite_unlock(SPIN_STRIPE(once_global, o));
 }
 
 static void _pthread_once_cleanup(void *o)
@@ -259,6 +270,7 @@ int pthread_delay_np (const struct timespec *interval)
 {
   DWORD to = (!interval ? 0 : dwMilliSecs(_pthread_time_in_ms_from_timespec(interval)));
   pthread_t s = pthread_self();
+  HANDLE ev;
   if(!to)
   {
     pthread_testcancel();
@@ -267,9 +279,9 @@ int pthread_delay_np (const struct timespec *interval)
     return 0;
   }
   pthread_testcancel();
-  if (s.p->evStart)
+  if (s.p && (ev = _pthread_get_cancel_event()) != NULL)
   {
-    WaitForSingleObject(s.p->evStart, to);
+    WaitForSingleObject(ev, to);
   }
   else
   {
@@ -461,7 +473,7 @@ int pthread_setspecific(pthread_key_t key, const void *value)
 {
     _pthread_v *t = pthread_self().p;
 
-    if (key > t->keymax)
+    if (key >= t->keymax)
     {
         int keymax = (key + 1) * 2;
         void **kv = (void **)realloc(t->keyval, keymax * sizeof(void *));
@@ -549,8 +561,7 @@ pthread_t pthread_self(void)
 
         t->p_state = PTHREAD_DEFAULT_ATTR /*| PTHREAD_CREATE_DETACHED*/;
         t->tid = GetCurrentThreadId();
-        t->evStart = CreateEvent (NULL, 1, 0, NULL);
-        t->p_clock = PTHREAD_MUTEX_INITIALIZER;
+        t->p_clock = mutex_initializer;
         t->sched_pol = SCHED_OTHER;
         t->h = NULL; //GetCurrentThread();
 	if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &t->h, 0, FALSE, DUPLICATE_SAME_ACCESS))
@@ -607,6 +618,45 @@ pthread_t pthread_self(void)
     return ret;
 }
 
+/* Returns the auto-reset event the calling thread parks on while it is
+   queued on a mutex.  It lives until the thread's memory is recycled.  */
+HANDLE _pthread_get_park_event(void)
+{
+    _pthread_v *t = pthread_self().p;
+
+    if (!t)
+      return NULL;
+    if (!t->evPark)
+      t->evPark = CreateEvent (NULL, 0, 0, NULL);
+    return t->evPark;
+}
+
+/* Returns the manual-reset event pthread_cancel sets for the calling
+   thread, so that a blocking cancellation point waits for it together
+   with its object instead of polling for a request.  Most threads never
+   block in one, so it is created on first use.  */
+HANDLE _pthread_get_cancel_event(void)
+{
+    _pthread_v *t = pthread_self().p;
+    HANDLE ev;
+
+    /* Not again once it was closed at the end of the thread.  */
+    if (!t || t->ended)
+      return NULL;
+    if ((ev = t->evStart) != NULL)
+      return ev;
+    pthread_mutex_lock(&t->p_clock);
+    if ((ev = t->evStart) == NULL && (ev = CreateEvent (NULL, 1, 0, NULL)) != NULL)
+    {
+      /* Canceled before there was an event to set.  */
+      if (t->cancelled && (t->p_state & PTHREAD_CANCEL_ENABLE) != 0)
+	SetEvent(ev);
+      t->evStart = ev;
+    }
+    pthread_mutex_unlock(&t->p_clock);
+    return ev;
+}
+
 int pthread_get_concurrency(int *val)
 {
     *val = _pthread_concur;
@@ -683,7 +733,8 @@ void pthread_testcancel(void)
   if (self.p->cancelled && (self.p->p_state & PTHREAD_CANCEL_ENABLE) && self.p->nobreak <= 0)
   {
     self.p->p_state &= ~PTHREAD_CANCEL_ENABLE;
-    ResetEvent(self.p->evStart);
+    if (self.p->evStart)
+      ResetEvent(self.p->evStart);
     pthread_mutex_unlock(&self.p->p_clock);
     _pthread_invoke_cancel();
   }
@@ -704,7 +755,7 @@ int pthread_cancel(pthread_t t)
       if(tv->cancelled) return (tv->in_cancel ? ESRCH : 0);
       tv->cancelled = 1;
       InterlockedIncrement(&_pthread_cancelling);
-      if(tv->evStart) SetEvent(tv->evStart);
+      if(tv->evStart && (tv->p_state & PTHREAD_CANCEL_ENABLE) != 0) SetEvent(tv->evStart);
       if ((tv->p_state & PTHREAD_CANCEL_ASYNCHRONOUS) != 0 && (tv->p_state & PTHREAD_CANCEL_ENABLE) != 0)
       {
         tv->p_state &= ~PTHREAD_CANCEL_ENABLE;
@@ -759,7 +810,10 @@ int pthread_cancel(pthread_t t)
 
         /* Notify everyone to look */
         InterlockedIncrement(&_pthread_cancelling);
-        if(tv->evStart) SetEvent(tv->evStart);
+        if(tv->evStart && (tv->p_state & PTHREAD_CANCEL_ENABLE) != 0) SetEvent(tv->evStart);
+#if defined USE_COND_ConditionVariable
+        if (tv->cv_wait) _cond_cancel_wake(tv->cv_wait);
+#endif
       }
       else
       {
@@ -879,7 +933,7 @@ static void test_cancel_locked (pthread_t t)
     return;
   if ((t.p->p_state & PTHREAD_CANCEL_ASYNCHRONOUS) == 0)
     return;
-  if (WaitForSingleObject(t.p->evStart, 0) != WAIT_OBJECT_0)
+  if (!t.p->cancelled)
     return;
   pthread_mutex_unlock(&t.p->p_clock);
   _pthread_invoke_cancel();
@@ -895,6 +949,14 @@ int pthread_setcancelstate(int state, int *oldstate)
     if (oldstate) *oldstate = t.p->p_state & PTHREAD_CANCEL_ENABLE;
     t.p->p_state &= ~PTHREAD_CANCEL_ENABLE;
     t.p->p_state |= state;
+    /* evStart is only set while a request can be acted on.  */
+    if (t.p->evStart)
+    {
+      if (state != PTHREAD_CANCEL_ENABLE)
+	ResetEvent(t.p->evStart);
+      else if (t.p->cancelled)
+	SetEvent(t.p->evStart);
+    }
     test_cancel_locked(t);
     pthread_mutex_unlock(&t.p->p_clock);
 
@@ -995,20 +1057,11 @@ int pthread_create(pthread_t *th, const pthread_attr_t *attr, void *(* func)(voi
     tv->func = func;
     tv->p_state = PTHREAD_DEFAULT_ATTR;
     tv->h = INVALID_HANDLE_VALUE;
-    tv->evStart = CreateEvent (NULL, 1, 0, NULL);
-    tv->p_clock = PTHREAD_MUTEX_INITIALIZER;
+    tv->p_clock = mutex_initializer;
     //tv->tmpEv = CreateEvent (NULL, 1, 0, NULL);
     tv->valid = LIFE_THREAD;
     tv->sched.sched_priority = THREAD_PRIORITY_NORMAL;
     tv->sched_pol = SCHED_OTHER;
-    if (tv->evStart == NULL)
-    {
-      if (tv->evStart)
-        CloseHandle(tv->evStart);
-      if (th) memset(th,0, sizeof(pthread_t));
-      push_pthread_mem(tv);
-      return EAGAIN;
-    }
  
     if (attr)
     {
@@ -1054,7 +1107,6 @@ int pthread_create(pthread_t *th, const pthread_attr_t *attr, void *(* func)(voi
       }
       SetThreadPriority(thrd, pr);
     }
-    ResetEvent(tv->evStart);
     if (tv->p_state & PTHREAD_CREATE_DETACHED)
     {
       tv->h = 0;
@@ -11,6 +11,8 @@
 typedef struct _pthread_v _pthread_v;
 struct _pthread_v
 {
+    unsigned int keymax;	/* keys first, see pthread_inline.h */
+    void **keyval;
     pthread_t hlp;
     unsigned int valid;   
     void *ret_arg;
@@ -18,20 +20,23 @@ struct _pthread_v
     _pthread_cleanup *clean;
     int nobreak;
     HANDLE h;
-    HANDLE evStart;
+    HANDLE evStart; /* Set by pthread_cancel, created on first use.  */
+    HANDLE evPark; /* Blocks queued mutex waiters, created on first use.  */
+    HANDLE hprio; /* Lets priority mutexes boost it, see mutex_prio_locked.  */
     pthread_mutex_t p_clock;
+    struct cond_t *cv_wait; /* Native cond slept on, guarded by p_clock.  */
     int cancelled : 2;
     int in_cancel : 2;
     int thread_noposix : 2;
     unsigned int p_state;
-    unsigned int keymax;
-    void **keyval;
     DWORD tid;
     int rwlc;
     pthread_rwlock_t rwlq[RWLS_PER_THREAD];
     int sched_pol;
     int ended;
     struct sched_param sched;
+    volatile LONG pi_locks; /* PTHREAD_PRIO_INHERIT/PROTECT mutexes held.  */
+    volatile LONG pi_prio; /* Priority while pi_locks, maybe raised by them.  */
     jmp_buf jb;
     struct _pthread_v *next;
     int x; /* Internal posix handle.  */
@@ -44,5 +49,10 @@ void thread_print_set(int state);
 void thread_print(volatile pthread_t t, char *txt);
 #endif
 int  __pthread_shallcancel(void);
+HANDLE _pthread_get_park_event(void);
+HANDLE _pthread_get_cancel_event(void);
+#if defined USE_COND_ConditionVariable
+void _cond_cancel_wake(struct cond_t *_c);
+#endif
 
 #endif
@@ -0,0 +1,111 @@
+/* 
+ * cancel10.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Test a cancellation request while cancellation is disabled.  The
+ * thread blocks in sem_wait() and pthread_cond_wait() with cancellation
+ * disabled while main cancels it.  Both must wait for their post or
+ * signal, and the request must only be acted on once cancellation is
+ * enabled again.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *      pthread_cancel()
+ *      pthread_setcancelstate()
+ *	sem_wait()
+ *	pthread_cond_wait()
+ */
+
+#include "test.h"
+#include <semaphore.h>
+
+static sem_t sem;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cv = PTHREAD_COND_INITIALIZER;
+static volatile int ready = 0;
+static int signaled = 0;
+static int reached = 0;
+
+void *
+mythread(void * arg)
+{
+  assert(pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL) == 0);
+  ready = 1;
+  assert(sem_wait(&sem) == 0);
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  ready = 2;
+  while (!signaled)
+    assert(pthread_cond_wait(&cv, &mutex) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  reached = 1;
+  assert(pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) == 0);
+  pthread_testcancel();
+  reached = 2;
+
+  return 0;
+}
+
+int
+main()
+{
+  pthread_t t;
+  void *result = NULL;
+
+  assert(sem_init(&sem, 0, 0) == 0);
+  assert(pthread_create(&t, NULL, mythread, NULL) == 0);
+  while (ready != 1)
+    Sleep(1);
+  Sleep(50);
+  assert(pthread_cancel(t) == 0);
+  Sleep(50);
+  assert(sem_post(&sem) == 0);
+
+  while (ready != 2)
+    Sleep(1);
+  Sleep(50);
+  assert(pthread_mutex_lock(&mutex) == 0);
+  signaled = 1;
+  assert(pthread_cond_signal(&cv) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  assert(pthread_join(t, &result) == 0);
+  assert(result == PTHREAD_CANCELED);
+  assert(reached == 1);
+  assert(sem_destroy(&sem) == 0);
+
+  return 0;
+}
@@ -0,0 +1,148 @@
+/* 
+ * condvar10.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Test broadcast wakeups of many waiters.
+ * NUMTHREADS threads wait on a condition variable, half of them with a
+ * timeout, and main broadcasts while holding the mutex.  Each waiter must
+ * return once, owning the mutex, which an error checking mutex verifies
+ * at unlock.  The condition variable can be destroyed right after the
+ * broadcast, before the waiters got the mutex back.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *      pthread_mutexattr_settype()
+ *      pthread_mutexattr_setpolicy_np()
+ *	pthread_cond_wait()
+ *	pthread_cond_timedwait()
+ *	pthread_cond_broadcast()
+ *	pthread_cond_destroy()
+ */
+
+#include "test.h"
+#include <sys/timeb.h>
+
+#define NUMTHREADS	64
+#define ROUNDS		3
+
+static pthread_mutex_t mutex;
+static pthread_cond_t cv;
+static int gen = 0;
+static int waiting = 0;
+static int awake = 0;
+
+void *
+waiter(void * arg)
+{
+  struct timespec abstime;
+  struct _timeb currSysTime;
+  const DWORD NANOSEC_PER_MILLISEC = 1000000;
+  int mygen;
+  int timed = (int) (size_t) arg & 1;
+
+  _ftime(&currSysTime);
+  abstime.tv_sec = currSysTime.time + 60;
+  abstime.tv_nsec = NANOSEC_PER_MILLISEC * currSysTime.millitm;
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  mygen = gen;
+  waiting++;
+  while (gen == mygen)
+    {
+      if (timed)
+	assert(pthread_cond_timedwait(&cv, &mutex, &abstime) == 0);
+      else
+	assert(pthread_cond_wait(&cv, &mutex) == 0);
+    }
+  awake++;
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  return 0;
+}
+
+static void
+broadcastRound(int type, int policy)
+{
+  pthread_mutexattr_t ma;
+  pthread_t t[NUMTHREADS];
+  int i, n;
+
+  assert(pthread_mutexattr_init(&ma) == 0);
+  assert(pthread_mutexattr_settype(&ma, type) == 0);
+  assert(pthread_mutexattr_setpolicy_np(&ma, policy) == 0);
+  assert(pthread_mutex_init(&mutex, &ma) == 0);
+  assert(pthread_mutexattr_destroy(&ma) == 0);
+  assert(pthread_cond_init(&cv, NULL) == 0);
+  waiting = awake = 0;
+
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(pthread_create(&t[i], NULL, waiter, (void *) (size_t) i) == 0);
+
+  do
+    {
+      Sleep(10);
+      assert(pthread_mutex_lock(&mutex) == 0);
+      n = waiting;
+      if (n < NUMTHREADS)
+	assert(pthread_mutex_unlock(&mutex) == 0);
+    }
+  while (n < NUMTHREADS);
+
+  gen++;
+  assert(pthread_cond_broadcast(&cv) == 0);
+  assert(pthread_cond_destroy(&cv) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(pthread_join(t[i], NULL) == 0);
+  assert(awake == NUMTHREADS);
+  assert(pthread_mutex_destroy(&mutex) == 0);
+}
+
+int
+main()
+{
+  int i;
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      broadcastRound(PTHREAD_MUTEX_NORMAL, PTHREAD_MUTEX_POLICY_DEFAULT_NP);
+      broadcastRound(PTHREAD_MUTEX_ERRORCHECK, PTHREAD_MUTEX_POLICY_DEFAULT_NP);
+      broadcastRound(PTHREAD_MUTEX_ERRORCHECK, PTHREAD_MUTEX_POLICY_FIFO_NP);
+      broadcastRound(PTHREAD_MUTEX_RECURSIVE, PTHREAD_MUTEX_POLICY_DEFAULT_NP);
+    }
+
+  return 0;
+}
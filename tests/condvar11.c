@@ -0,0 +1,159 @@
+/* 
+ * condvar11.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Test timed waits on a condition variable using CLOCK_MONOTONIC.
+ * The clock is kept apart from the process-shared flag in the
+ * attributes.  A wait must not time out before its deadline on the
+ * monotonic clock, nor long after it, and a signal ends it early.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *      pthread_condattr_setclock()
+ *      pthread_condattr_getclock()
+ *      clock_gettime()
+ *	pthread_cond_timedwait()
+ *	pthread_cond_signal()
+ */
+
+#include "test.h"
+
+static pthread_mutex_t mutex;
+static pthread_cond_t cv;
+static int signaled = 0;
+
+static long long
+elapsedMs(const struct timespec *from, const struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) * 1000LL
+	 + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+static void
+addMs(struct timespec *ts, int ms)
+{
+  ts->tv_sec += ms / 1000;
+  ts->tv_nsec += (ms % 1000) * 1000000L;
+  if (ts->tv_nsec >= 1000000000L)
+    {
+      ts->tv_sec++;
+      ts->tv_nsec -= 1000000000L;
+    }
+}
+
+void *
+signaler(void * arg)
+{
+  Sleep(50);
+  assert(pthread_mutex_lock(&mutex) == 0);
+  signaled = 1;
+  assert(pthread_cond_signal(&cv) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  return 0;
+}
+
+int
+main()
+{
+  pthread_condattr_t ca;
+  pthread_t t;
+  struct timespec start, abstime, now, res;
+  clockid_t clk;
+  int s, i;
+
+  assert(pthread_condattr_init(&ca) == 0);
+  assert(pthread_condattr_getclock(&ca, &clk) == 0);
+  assert(clk == CLOCK_REALTIME);
+  assert(pthread_condattr_setclock(&ca, CLOCK_MONOTONIC) == 0);
+  assert(pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED) == 0);
+  assert(pthread_condattr_getclock(&ca, &clk) == 0);
+  assert(clk == CLOCK_MONOTONIC);
+  assert(pthread_condattr_getpshared(&ca, &s) == 0);
+  assert(s == PTHREAD_PROCESS_SHARED);
+  assert(pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_PRIVATE) == 0);
+  assert(pthread_condattr_getpshared(&ca, &s) == 0);
+  assert(s == PTHREAD_PROCESS_PRIVATE);
+  assert(pthread_condattr_setclock(&ca, 42) == EINVAL);
+  assert(pthread_condattr_getclock(&ca, &clk) == 0);
+  assert(clk == CLOCK_MONOTONIC);
+
+  assert(clock_getres(CLOCK_MONOTONIC, &res) == 0);
+  assert(res.tv_sec == 0 && res.tv_nsec > 0 && res.tv_nsec < 1000000L);
+  assert(clock_gettime(CLOCK_MONOTONIC, &start) == 0);
+  for (i = 0; i < 1000; i++)
+    {
+      assert(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+      assert(now.tv_nsec >= 0 && now.tv_nsec < 1000000000L);
+      assert(elapsedMs(&start, &now) >= 0);
+    }
+
+  assert(pthread_cond_init(&cv, &ca) == 0);
+  assert(pthread_condattr_destroy(&ca) == 0);
+  assert(pthread_mutex_init(&mutex, NULL) == 0);
+
+  /* Time out.  */
+  assert(pthread_mutex_lock(&mutex) == 0);
+  for (i = 0; i < 5; i++)
+    {
+      assert(clock_gettime(CLOCK_MONOTONIC, &start) == 0);
+      abstime = start;
+      addMs(&abstime, 30 + i * 7);
+      assert(pthread_cond_timedwait(&cv, &mutex, &abstime) == ETIMEDOUT);
+      assert(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+      assert(now.tv_sec > abstime.tv_sec
+	     || (now.tv_sec == abstime.tv_sec && now.tv_nsec >= abstime.tv_nsec));
+      assert(elapsedMs(&abstime, &now) < 1000);
+    }
+
+  /* A deadline in the past.  */
+  assert(pthread_cond_timedwait(&cv, &mutex, &start) == ETIMEDOUT);
+
+  /* Signaled before the deadline.  */
+  assert(pthread_create(&t, NULL, signaler, NULL) == 0);
+  assert(clock_gettime(CLOCK_MONOTONIC, &abstime) == 0);
+  addMs(&abstime, 10000);
+  while (!signaled)
+    assert(pthread_cond_timedwait(&cv, &mutex, &abstime) == 0);
+  assert(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+  assert(elapsedMs(&now, &abstime) > 5000);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(pthread_join(t, NULL) == 0);
+
+  assert(pthread_cond_destroy(&cv) == 0);
+  assert(pthread_mutex_destroy(&mutex) == 0);
+
+  return 0;
+}
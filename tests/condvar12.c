@@ -0,0 +1,197 @@
+/* 
+ * condvar12.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Test waiting on several condition variables at once.
+ * A consumer waits on NUMCV condition variables sharing one mutex and
+ * must be woken by each of them in turn, with the index of the one
+ * signaled.  Then NUMTHREADS threads wait on two of them: a signal on
+ * one wakes a single thread, and a broadcast on the other the rest.
+ * Woken waiters must leave the other queues, so all condition
+ * variables can be destroyed afterwards.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *	pthread_cond_wait_any_np()
+ *	pthread_cond_signal()
+ *	pthread_cond_broadcast()
+ */
+
+#include "test.h"
+
+#define NUMCV		3
+#define NUMTHREADS	8
+#define ROUNDS		30
+
+static pthread_mutex_t mutex;
+static pthread_cond_t cv[NUMCV];
+static pthread_cond_t *cvp[NUMCV];
+static int pending[NUMCV];
+static int consumed = 0;
+static int waiting = 0;
+static int awake = 0;
+static int gen = 0;
+
+void *
+consumer(void * arg)
+{
+  int i, which;
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  while (consumed < ROUNDS)
+    {
+      for (i = 0; i < NUMCV && !pending[i]; i++)
+	;
+      if (i == NUMCV)
+	{
+	  assert(pthread_cond_wait_any_np(cvp, NUMCV, &mutex, NULL, &which) == 0);
+	  assert(which >= 0 && which < NUMCV);
+	  continue;
+	}
+      pending[i] = 0;
+      consumed++;
+    }
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  return 0;
+}
+
+void *
+waiter(void * arg)
+{
+  int mygen, which;
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  mygen = gen;
+  waiting++;
+  while (gen == mygen)
+    assert(pthread_cond_wait_any_np(cvp, 2, &mutex, NULL, &which) == 0);
+  awake++;
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  return 0;
+}
+
+int
+main()
+{
+  pthread_t t[NUMTHREADS];
+  struct timespec abstime = { 0, 0 };
+  pthread_cond_t *dup[2];
+  int i, r, which;
+
+  assert(pthread_mutex_init(&mutex, NULL) == 0);
+  for (i = 0; i < NUMCV; i++)
+    {
+      assert(pthread_cond_init(&cv[i], NULL) == 0);
+      cvp[i] = &cv[i];
+    }
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  r = pthread_cond_wait_any_np(cvp, NUMCV, &mutex, &abstime, &which);
+  if (r == ENOTSUP)
+    {
+      assert(pthread_mutex_unlock(&mutex) == 0);
+      fprintf(stderr, "Test N/A for native condition variables.\n");
+      return 0;
+    }
+  assert(r == ETIMEDOUT);
+  assert(which == -1);
+  dup[0] = dup[1] = &cv[0];
+  which = 0;
+  assert(pthread_cond_wait_any_np(dup, 2, &mutex, &abstime, &which) == EINVAL);
+  assert(which == -1);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  /* One consumer, each condition variable in turn.  */
+  assert(pthread_create(&t[0], NULL, consumer, NULL) == 0);
+  for (i = 0; i < ROUNDS; i++)
+    {
+      Sleep(2);
+      assert(pthread_mutex_lock(&mutex) == 0);
+      pending[i % NUMCV] = 1;
+      assert(pthread_cond_signal(&cv[i % NUMCV]) == 0);
+      assert(pthread_mutex_unlock(&mutex) == 0);
+      do
+	{
+	  Sleep(1);
+	  assert(pthread_mutex_lock(&mutex) == 0);
+	  r = pending[i % NUMCV];
+	  assert(pthread_mutex_unlock(&mutex) == 0);
+	}
+      while (r);
+    }
+  assert(pthread_join(t[0], NULL) == 0);
+  assert(consumed == ROUNDS);
+
+  /* Many waiters on the first two.  */
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(pthread_create(&t[i], NULL, waiter, NULL) == 0);
+  do
+    {
+      Sleep(10);
+      assert(pthread_mutex_lock(&mutex) == 0);
+      r = waiting;
+      if (r < NUMTHREADS)
+	assert(pthread_mutex_unlock(&mutex) == 0);
+    }
+  while (r < NUMTHREADS);
+  gen++;
+  assert(pthread_cond_signal(&cv[0]) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  do
+    {
+      Sleep(10);
+      assert(pthread_mutex_lock(&mutex) == 0);
+      r = awake;
+      assert(pthread_mutex_unlock(&mutex) == 0);
+    }
+  while (r == 0);
+  Sleep(100);
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(awake == 1);
+  assert(pthread_cond_destroy(&cv[0]) == EBUSY);
+  assert(pthread_cond_broadcast(&cv[1]) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(pthread_join(t[i], NULL) == 0);
+  assert(awake == NUMTHREADS);
+
+  for (i = 0; i < NUMCV; i++)
+    assert(pthread_cond_destroy(&cv[i]) == 0);
+  assert(pthread_mutex_destroy(&mutex) == 0);
+
+  return 0;
+}
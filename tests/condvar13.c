@@ -0,0 +1,132 @@
+/* 
+ * condvar13.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Test canceling one of several waiters.  NUMTHREADS threads wait on a
+ * condition variable, then the first is canceled, right after a signal
+ * every other round.  Whether or not the canceled waiter took that
+ * signal, the others must be woken by signals, and the condition
+ * variable can be destroyed afterwards without a broadcast.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *      pthread_cancel()
+ *	pthread_cond_wait()
+ *	pthread_cond_signal()
+ *	pthread_cond_destroy()
+ */
+
+#include "test.h"
+
+#define NUMTHREADS	4
+#define ROUNDS		40
+
+static pthread_mutex_t mutex;
+static pthread_cond_t cv;
+static int waiting = 0;
+static int woken = 0;
+
+static void
+unlock_mutex(void * arg)
+{
+  assert(pthread_mutex_unlock((pthread_mutex_t *) arg) == 0);
+}
+
+void *
+waiter(void * arg)
+{
+  assert(pthread_mutex_lock(&mutex) == 0);
+  pthread_cleanup_push(unlock_mutex, &mutex);
+  waiting++;
+  assert(pthread_cond_wait(&cv, &mutex) == 0);
+  woken++;
+  pthread_cleanup_pop(1);
+
+  return 0;
+}
+
+int
+main()
+{
+  pthread_t t[NUMTHREADS];
+  void *result;
+  int i, n, r, last, canceled;
+
+  assert(pthread_mutex_init(&mutex, NULL) == 0);
+  for (n = 0; n < ROUNDS; n++)
+    {
+      assert(pthread_cond_init(&cv, NULL) == 0);
+      waiting = woken = 0;
+      for (i = 0; i < NUMTHREADS; i++)
+	assert(pthread_create(&t[i], NULL, waiter, NULL) == 0);
+      do
+	{
+	  Sleep(1);
+	  assert(pthread_mutex_lock(&mutex) == 0);
+	  r = waiting;
+	  assert(pthread_mutex_unlock(&mutex) == 0);
+	}
+      while (r < NUMTHREADS);
+
+      if (n & 1)
+	assert(pthread_cond_signal(&cv) == 0);
+      assert(pthread_cancel(t[0]) == 0);
+      assert(pthread_join(t[0], &result) == 0);
+      canceled = (result == PTHREAD_CANCELED);
+      assert(canceled || result == NULL);
+
+      /* Signal again whenever nobody else woke up, a signal the
+	 canceled waiter took must have gone on to another one.  */
+      for (i = 0, last = -1; i < 2000; i++)
+	{
+	  assert(pthread_mutex_lock(&mutex) == 0);
+	  r = woken;
+	  assert(pthread_mutex_unlock(&mutex) == 0);
+	  if (r == NUMTHREADS - canceled)
+	    break;
+	  if (r == last && i % 10 == 0)
+	    assert(pthread_cond_signal(&cv) == 0);
+	  last = r;
+	  Sleep(1);
+	}
+      assert(r == NUMTHREADS - canceled);
+      for (i = 1; i < NUMTHREADS; i++)
+	assert(pthread_join(t[i], NULL) == 0);
+      assert(pthread_cond_destroy(&cv) == 0);
+    }
+  assert(pthread_mutex_destroy(&mutex) == 0);
+
+  return 0;
+}
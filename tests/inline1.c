@@ -0,0 +1,157 @@
+/* 
+ * inline1.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Tests the inline fast paths of pthread_inline.h.
+ * Threads count under a mutex and a spinlock locked inline, with
+ * both static initializers and initialized objects, and must not
+ * lose updates.  Thread specific data must read back as set.
+ * Statistics turned on must still see the inline acquisitions, and
+ * the fast paths must be taken again once they are turned off.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *	pthread_mutex_lock()
+ *	pthread_mutex_trylock()
+ *	pthread_mutex_unlock()
+ *	pthread_spin_lock()
+ *	pthread_spin_trylock()
+ *	pthread_spin_unlock()
+ *	pthread_key_create()
+ *	pthread_getspecific()
+ *	pthread_setspecific()
+ */
+
+#define WINPTHREAD_INLINE 1
+#include "test.h"
+
+#define NUMTHREADS 4
+#define ITERATIONS 20000
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t rmutex;
+static pthread_spinlock_t lock = PTHREAD_SPINLOCK_INITIALIZER;
+static pthread_key_t key;
+static int mutexCount = 0;
+static int spinCount = 0;
+
+void * func(void * arg)
+{
+  int i;
+
+  assert(pthread_getspecific(key) == NULL);
+  assert(pthread_setspecific(key, arg) == 0);
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      assert(pthread_mutex_lock(&mutex) == 0);
+      mutexCount++;
+      assert(pthread_mutex_unlock(&mutex) == 0);
+
+      assert(pthread_spin_lock(&lock) == 0);
+      spinCount++;
+      assert(pthread_spin_unlock(&lock) == 0);
+
+      assert(pthread_getspecific(key) == arg);
+    }
+
+  return 0;
+}
+
+int
+main()
+{
+  pthread_t t[NUMTHREADS];
+  pthread_mutexattr_t ma;
+  pthread_mutex_stats_np ms;
+  pthread_spin_stats_np ss;
+  int i;
+
+  assert(pthread_key_create(&key, NULL) == 0);
+
+  /* Objects the fast paths leave to the library.  */
+  assert(pthread_mutexattr_init(&ma) == 0);
+  assert(pthread_mutexattr_settype(&ma, PTHREAD_MUTEX_RECURSIVE) == 0);
+  assert(pthread_mutex_init(&rmutex, &ma) == 0);
+  assert(pthread_mutex_lock(&rmutex) == 0);
+  assert(pthread_mutex_trylock(&rmutex) == 0);
+  assert(pthread_mutex_unlock(&rmutex) == 0);
+  assert(pthread_mutex_unlock(&rmutex) == 0);
+  assert(pthread_mutex_unlock(&rmutex) == EPERM);
+  assert(pthread_mutex_destroy(&rmutex) == 0);
+
+  assert(pthread_mutex_trylock(&mutex) == 0);
+  assert(pthread_mutex_trylock(&mutex) == EBUSY);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(pthread_spin_trylock(&lock) == 0);
+  assert(pthread_spin_trylock(&lock) == EBUSY);
+  assert(pthread_spin_unlock(&lock) == 0);
+  assert(pthread_spin_unlock(&lock) == EPERM);
+
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(pthread_create(&t[i], NULL, func, (void *) (size_t) (i + 1)) == 0);
+
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(pthread_join(t[i], NULL) == 0);
+
+  assert(mutexCount == NUMTHREADS * ITERATIONS);
+  assert(spinCount == NUMTHREADS * ITERATIONS);
+
+  assert(pthread_mutex_setstats_np(1) == 0);
+  assert(pthread_spin_setstats_np(1) == 0);
+  for (i = 0; i < 10; i++)
+    {
+      assert(pthread_mutex_lock(&mutex) == 0);
+      assert(pthread_mutex_unlock(&mutex) == 0);
+      assert(pthread_spin_lock(&lock) == 0);
+      assert(pthread_spin_unlock(&lock) == 0);
+    }
+  assert(pthread_mutex_setstats_np(0) == 0);
+  assert(pthread_spin_setstats_np(0) == 0);
+  assert(pthread_mutex_getstats_np(&mutex, &ms) == 0);
+  assert(ms.acquisitions == 10);
+  assert(pthread_spin_getstats_np(&lock, &ss) == 0);
+  assert(ss.acquisitions == 10);
+  assert(_pthread_mutex_inline_ref(&mutex) != NULL);
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(pthread_mutex_getstats_np(&mutex, &ms) == 0);
+  assert(ms.acquisitions == 10);
+
+  assert(pthread_mutex_destroy(&mutex) == 0);
+  assert(pthread_spin_destroy(&lock) == 0);
+
+  return 0;
+}
@@ -0,0 +1,127 @@
+/* 
+ * mutex10.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Tests the mutex contention statistics.
+ * A thread has to wait for a mutex held by main, which
+ * has to show up in the statistics of that mutex.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *      pthread_mutex_setstats_np()
+ *      pthread_mutex_getstats_np()
+ *      pthread_mutex_enumstats_np()
+ *      pthread_mutex_init()
+ *	pthread_mutex_lock()
+ *	pthread_mutex_unlock()
+ */
+
+#include "test.h"
+
+static pthread_mutex_t mutex;
+static int found = 0;
+
+void * locker(void * arg)
+{
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  return 0;
+}
+
+static int
+count(pthread_mutex_t *m, const pthread_mutex_stats_np *s, void *arg)
+{
+  if (m == &mutex)
+    {
+      assert(s->acquisitions == 12);
+      found++;
+    }
+  return 0;
+}
+
+int
+main()
+{
+  pthread_mutex_stats_np s;
+  pthread_t t;
+  int i;
+
+  assert(pthread_mutex_setstats_np(1) == 0);
+  assert(pthread_mutex_init(&mutex, NULL) == 0);
+
+  for (i = 0; i < 10; i++)
+    {
+      assert(pthread_mutex_lock(&mutex) == 0);
+      assert(pthread_mutex_unlock(&mutex) == 0);
+    }
+  assert(pthread_mutex_getstats_np(&mutex, &s) == 0);
+  assert(s.acquisitions == 10);
+  assert(s.contended == 0);
+  assert(s.waiters == 0);
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_create(&t, NULL, locker, NULL) == 0);
+  Sleep(200);
+  assert(pthread_mutex_getstats_np(&mutex, &s) == 0);
+  assert(s.waiters == 1);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(pthread_join(t, NULL) == 0);
+
+  assert(pthread_mutex_getstats_np(&mutex, &s) == 0);
+  assert(s.acquisitions == 12);
+  assert(s.contended == 1);
+  assert(s.waiters == 0);
+  assert(s.wait_time_max >= 100000000ULL);
+  assert(s.wait_time >= s.wait_time_max);
+  assert(s.hold_time >= 100000000ULL);
+
+  assert(pthread_mutex_setstats_np(0) == 0);
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(pthread_mutex_getstats_np(&mutex, &s) == 0);
+  assert(s.acquisitions == 12);
+
+  assert(pthread_mutex_enumstats_np(count, NULL) == 0);
+  assert(found == 1);
+
+  assert(pthread_mutex_destroy(&mutex) == 0);
+
+  found = 0;
+  assert(pthread_mutex_enumstats_np(count, NULL) == 0);
+  assert(found == 0);
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+/* 
+ * mutex11.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Tests the recursion depth of PTHREAD_MUTEX_RECURSIVE mutexes.
+ * Only the owner sees its depth, other threads see 0.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *      pthread_mutexattr_init()
+ *      pthread_mutexattr_settype()
+ *      pthread_mutex_init()
+ *	pthread_mutex_lock()
+ *	pthread_mutex_trylock()
+ *	pthread_mutex_unlock()
+ *	pthread_mutex_getrecursion_np()
+ */
+
+#include "test.h"
+
+static pthread_mutex_t mutex;
+static pthread_mutexattr_t mxAttr;
+
+void * peeker(void * arg)
+{
+  int depth = -1;
+
+  assert(pthread_mutex_getrecursion_np(&mutex, &depth) == 0);
+  assert(depth == 0);
+
+  return 0;
+}
+ 
+int
+main()
+{
+  pthread_t t;
+  int depth = -1;
+
+  assert(pthread_mutexattr_init(&mxAttr) == 0);
+  assert(pthread_mutexattr_settype(&mxAttr, PTHREAD_MUTEX_RECURSIVE) == 0);
+  assert(pthread_mutex_init(&mutex, &mxAttr) == 0);
+
+  assert(pthread_mutex_getrecursion_np(&mutex, &depth) == 0);
+  assert(depth == 0);
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_mutex_trylock(&mutex) == 0);
+  assert(pthread_mutex_getrecursion_np(&mutex, &depth) == 0);
+  assert(depth == 3);
+
+  assert(pthread_create(&t, NULL, peeker, NULL) == 0);
+  assert(pthread_join(t, NULL) == 0);
+
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(pthread_mutex_getrecursion_np(&mutex, &depth) == 0);
+  assert(depth == 2);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(pthread_mutex_getrecursion_np(&mutex, &depth) == 0);
+  assert(depth == 0);
+  assert(pthread_mutex_unlock(&mutex) == EPERM);
+
+  assert(pthread_mutex_destroy(&mutex) == 0);
+
+  return 0;
+}
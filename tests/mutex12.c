@@ -0,0 +1,153 @@
+/* 
+ * mutex12.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Tests locking several mutexes at once.
+ * Two threads lock the same pair of mutexes, passed in opposite
+ * order, which must not deadlock.  A timed attempt on a pair with
+ * one mutex held elsewhere must time out and leave the other free.
+ * The same with a process-shared mutex in the pair.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *      pthread_mutex_init()
+ *	pthread_mutex_lock()
+ *	pthread_mutex_trylock()
+ *	pthread_mutex_unlock()
+ *	pthread_mutex_lock_multiple_np()
+ *	pthread_mutex_timedlock_multiple_np()
+ *	pthread_mutexattr_setpshared()
+ */
+
+#include "test.h"
+
+#define ITERATIONS 10000
+
+static pthread_mutex_t mutexA;
+static pthread_mutex_t mutexB = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t mutexC;
+static pthread_mutex_t * second = &mutexB;
+static int lockCount = 0;
+
+void * locker(void * arg)
+{
+  pthread_mutex_t *mv[2];
+  int i;
+
+  mv[0] = (arg ? &mutexA : second);
+  mv[1] = (arg ? second : &mutexA);
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      assert(pthread_mutex_lock_multiple_np(mv, 2) == 0);
+      lockCount++;
+      assert(pthread_mutex_unlock(&mutexA) == 0);
+      assert(pthread_mutex_unlock(second) == 0);
+    }
+
+  return 0;
+}
+
+void * timedlocker(void * arg)
+{
+  pthread_mutex_t *mv[2] = { &mutexA, second };
+  struct timespec abstime = { 0, 0 };
+  struct _timeb currSysTime;
+  const DWORD NANOSEC_PER_MILLISEC = 1000000;
+
+  _ftime(&currSysTime);
+
+  abstime.tv_sec = currSysTime.time;
+  abstime.tv_nsec = NANOSEC_PER_MILLISEC * currSysTime.millitm;
+
+  abstime.tv_sec += 1;
+
+  assert(pthread_mutex_timedlock_multiple_np(mv, 2, &abstime) == ETIMEDOUT);
+  assert(pthread_mutex_trylock(&mutexA) == 0);
+  assert(pthread_mutex_unlock(&mutexA) == 0);
+
+  return 0;
+}
+ 
+int
+main()
+{
+  pthread_mutex_t *mv[2] = { &mutexA, &mutexA };
+  pthread_t t1, t2;
+#ifndef USE_MUTEX_InPlace
+  pthread_mutexattr_t ma;
+#endif
+
+  assert(pthread_mutex_init(&mutexA, NULL) == 0);
+
+  assert(pthread_mutex_lock_multiple_np(mv, 2) == EINVAL);
+
+  assert(pthread_create(&t1, NULL, locker, (void *) 1) == 0);
+  assert(pthread_create(&t2, NULL, locker, NULL) == 0);
+  assert(pthread_join(t1, NULL) == 0);
+  assert(pthread_join(t2, NULL) == 0);
+  assert(lockCount == 2 * ITERATIONS);
+
+  assert(pthread_mutex_lock(&mutexB) == 0);
+  assert(pthread_create(&t1, NULL, timedlocker, NULL) == 0);
+  assert(pthread_join(t1, NULL) == 0);
+  assert(pthread_mutex_unlock(&mutexB) == 0);
+
+#ifndef USE_MUTEX_InPlace
+  assert(pthread_mutexattr_init(&ma) == 0);
+  assert(pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED) == 0);
+  assert(pthread_mutex_init(&mutexC, &ma) == 0);
+  assert(pthread_mutexattr_destroy(&ma) == 0);
+  second = &mutexC;
+
+  lockCount = 0;
+  assert(pthread_create(&t1, NULL, locker, (void *) 1) == 0);
+  assert(pthread_create(&t2, NULL, locker, NULL) == 0);
+  assert(pthread_join(t1, NULL) == 0);
+  assert(pthread_join(t2, NULL) == 0);
+  assert(lockCount == 2 * ITERATIONS);
+
+  assert(pthread_mutex_lock(&mutexC) == 0);
+  assert(pthread_create(&t1, NULL, timedlocker, NULL) == 0);
+  assert(pthread_join(t1, NULL) == 0);
+  assert(pthread_mutex_unlock(&mutexC) == 0);
+
+  assert(pthread_mutex_destroy(&mutexC) == 0);
+#endif
+
+  assert(pthread_mutex_destroy(&mutexA) == 0);
+  assert(pthread_mutex_destroy(&mutexB) == 0);
+
+  return 0;
+}
@@ -0,0 +1,163 @@
+/* 
+ * mutex13.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Tests the PTHREAD_PRIO_PROTECT and PTHREAD_PRIO_INHERIT protocols.
+ * The owner of a PROTECT mutex runs at the ceiling of the mutex.
+ * The owner of an INHERIT mutex runs at the priority of a higher
+ * priority waiter.  Both get back their priority at unlock.  This has
+ * to work for a detached owner too, which doesn't keep its handle.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *      pthread_attr_setinheritsched()
+ *      pthread_attr_setschedparam()
+ *      pthread_attr_setdetachstate()
+ *      pthread_mutexattr_init()
+ *      pthread_mutexattr_setprotocol()
+ *      pthread_mutexattr_setprioceiling()
+ *      pthread_mutex_init()
+ *	pthread_mutex_lock()
+ *	pthread_mutex_unlock()
+ *	pthread_mutex_getprioceiling()
+ */
+
+#include "test.h"
+
+static pthread_mutex_t mutex;
+
+static int
+priority(void)
+{
+  return GetThreadPriority(pthread_getw32threadhandle_np(pthread_self()));
+}
+
+void * locker(void * arg)
+{
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  return 0;
+}
+
+static volatile int owned = 0;
+static volatile int boosted = 0;
+static volatile int restored = 0;
+
+/* A detached owner at THREAD_PRIORITY_LOWEST, boosted by main.  */
+void * owner(void * arg)
+{
+  int i;
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  owned = 1;
+  for (i = 0; i < 2000 && !boosted; i++)
+    {
+      boosted = (GetThreadPriority(GetCurrentThread()) == THREAD_PRIORITY_NORMAL);
+      Sleep(1);
+    }
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  restored = (GetThreadPriority(GetCurrentThread()) == THREAD_PRIORITY_LOWEST) ? 1 : -1;
+
+  return 0;
+}
+ 
+int
+main()
+{
+  pthread_mutexattr_t mxAttr;
+  pthread_attr_t attr;
+  struct sched_param param;
+  pthread_t t;
+  int value = -1;
+
+  assert(priority() == THREAD_PRIORITY_NORMAL);
+
+  assert(pthread_mutexattr_init(&mxAttr) == 0);
+  assert(pthread_mutexattr_setprotocol(&mxAttr, 99) == EINVAL);
+  assert(pthread_mutexattr_setprotocol(&mxAttr, PTHREAD_PRIO_PROTECT) == 0);
+  assert(pthread_mutexattr_getprotocol(&mxAttr, &value) == 0);
+  assert(value == PTHREAD_PRIO_PROTECT);
+  assert(pthread_mutexattr_setprioceiling(&mxAttr, 100) == EINVAL);
+  assert(pthread_mutexattr_setprioceiling(&mxAttr, THREAD_PRIORITY_LOWEST) == 0);
+  assert(pthread_mutexattr_getprioceiling(&mxAttr, &value) == 0);
+  assert(value == THREAD_PRIORITY_LOWEST);
+  assert(pthread_mutexattr_setprioceiling(&mxAttr, THREAD_PRIORITY_HIGHEST) == 0);
+
+  assert(pthread_mutex_init(&mutex, &mxAttr) == 0);
+  assert(pthread_mutex_getprioceiling(&mutex, &value) == 0);
+  assert(value == THREAD_PRIORITY_HIGHEST);
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(priority() == THREAD_PRIORITY_HIGHEST);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(priority() == THREAD_PRIORITY_NORMAL);
+  assert(pthread_mutex_destroy(&mutex) == 0);
+
+  assert(pthread_mutexattr_setprotocol(&mxAttr, PTHREAD_PRIO_INHERIT) == 0);
+  assert(pthread_mutex_init(&mutex, &mxAttr) == 0);
+  assert(pthread_mutex_getprioceiling(&mutex, &value) == 0);
+  assert(value == THREAD_PRIORITY_HIGHEST);
+
+  assert(pthread_attr_init(&attr) == 0);
+  assert(pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED) == 0);
+  param.sched_priority = THREAD_PRIORITY_HIGHEST;
+  assert(pthread_attr_setschedparam(&attr, &param) == 0);
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_create(&t, &attr, locker, NULL) == 0);
+  Sleep(500);
+  assert(priority() == THREAD_PRIORITY_HIGHEST);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(priority() == THREAD_PRIORITY_NORMAL);
+  assert(pthread_join(t, NULL) == 0);
+
+  param.sched_priority = THREAD_PRIORITY_LOWEST;
+  assert(pthread_attr_setschedparam(&attr, &param) == 0);
+  assert(pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0);
+  assert(pthread_create(&t, &attr, owner, NULL) == 0);
+  while (!owned)
+    Sleep(1);
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  while (!restored)
+    Sleep(1);
+  assert(boosted);
+  assert(restored == 1);
+
+  assert(pthread_mutex_destroy(&mutex) == 0);
+
+  return 0;
+}
@@ -0,0 +1,110 @@
+/* 
+ * mutex9.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Tests PTHREAD_MUTEX_POLICY_FIFO_NP.
+ * Threads queue up one after another on a mutex held by main.
+ * They must get the mutex in the order in which they arrived.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *      pthread_mutexattr_init()
+ *      pthread_mutexattr_setpolicy_np()
+ *      pthread_mutexattr_getpolicy_np()
+ *      pthread_mutex_init()
+ *	pthread_mutex_lock()
+ *	pthread_mutex_unlock()
+ */
+
+#include "test.h"
+
+#define NUMTHREADS 5
+
+static int order[NUMTHREADS];
+static int lockCount = 0;
+
+static pthread_mutex_t mutex;
+static pthread_mutexattr_t mxAttr;
+
+void * locker(void * arg)
+{
+  assert(pthread_mutex_lock(&mutex) == 0);
+  order[lockCount++] = (int) (size_t) arg;
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  return 0;
+}
+ 
+int
+main()
+{
+  pthread_t t[NUMTHREADS];
+  int policy = -1;
+  int i;
+
+  assert(pthread_mutexattr_init(&mxAttr) == 0);
+  assert(pthread_mutexattr_getpolicy_np(&mxAttr, &policy) == 0);
+  assert(policy == PTHREAD_MUTEX_POLICY_DEFAULT_NP);
+  assert(pthread_mutexattr_setpolicy_np(&mxAttr, 2) == EINVAL);
+  assert(pthread_mutexattr_setpolicy_np(&mxAttr, PTHREAD_MUTEX_POLICY_FIFO_NP) == 0);
+  assert(pthread_mutexattr_getpolicy_np(&mxAttr, &policy) == 0);
+  assert(policy == PTHREAD_MUTEX_POLICY_FIFO_NP);
+
+  assert(pthread_mutex_init(&mutex, &mxAttr) == 0);
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+
+  for (i = 0; i < NUMTHREADS; i++)
+    {
+      assert(pthread_create(&t[i], NULL, locker, (void *) (size_t) i) == 0);
+      /* Let it queue up before the next one arrives.  */
+      Sleep(100);
+    }
+
+  assert(lockCount == 0);
+
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(pthread_join(t[i], NULL) == 0);
+
+  assert(lockCount == NUMTHREADS);
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(order[i] == i);
+
+  assert(pthread_mutex_destroy(&mutex) == 0);
+
+  return 0;
+}
@@ -0,0 +1,229 @@
+/* 
+ * pshared1.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Tests objects initialized PTHREAD_PROCESS_SHARED.
+ * Within one process the threads must see the usual semantics
+ * for each kind of object: mutual exclusion for mutexes, rwlocks
+ * and spinlocks, wakeups for condition variables, barriers and
+ * semaphores, plus the trylock and timeout paths.  Objects whose
+ * state vanished, with the last process which had it open, must be
+ * rejected with EINVAL.  With USE_MUTEX_InPlace process-shared
+ * mutexes aren't supported, and the test uses a private one.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *	pthread_mutexattr_setpshared()
+ *	pthread_condattr_setpshared()
+ *	pthread_rwlockattr_setpshared()
+ *	pthread_barrierattr_setpshared()
+ *	sem_init()
+ *	pthread_spin_init()
+ */
+
+#include "test.h"
+#include <sys/timeb.h>
+
+#define NUMTHREADS 4
+#define ITERATIONS 10000
+
+static pthread_mutex_t mutex;
+static pthread_cond_t cv;
+static pthread_rwlock_t rwlock;
+static pthread_barrier_t barrier;
+static sem_t sema;
+static pthread_spinlock_t spin;
+
+static int mutexCount = 0;
+static int rwlockCount = 0;
+static int spinCount = 0;
+static int ready = 0;
+
+void * worker(void * arg)
+{
+  int i;
+
+  assert(pthread_barrier_wait(&barrier) != EINVAL);
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      assert(pthread_mutex_lock(&mutex) == 0);
+      mutexCount++;
+      assert(pthread_mutex_unlock(&mutex) == 0);
+
+      assert(pthread_rwlock_wrlock(&rwlock) == 0);
+      rwlockCount++;
+      assert(pthread_rwlock_unlock(&rwlock) == 0);
+      assert(pthread_rwlock_rdlock(&rwlock) == 0);
+      assert(pthread_rwlock_unlock(&rwlock) == 0);
+
+      assert(pthread_spin_lock(&spin) == 0);
+      spinCount++;
+      assert(pthread_spin_unlock(&spin) == 0);
+    }
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  while (!ready)
+    assert(pthread_cond_wait(&cv, &mutex) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  assert(sem_post(&sema) == 0);
+
+  return 0;
+}
+
+int
+main()
+{
+  pthread_t t[NUMTHREADS];
+  pthread_mutexattr_t ma;
+  pthread_condattr_t ca;
+  pthread_rwlockattr_t ra;
+  pthread_barrierattr_t ba;
+  struct timespec abstime = { 0, 0 };
+  struct _timeb currSysTime;
+  const DWORD NANOSEC_PER_MILLISEC = 1000000;
+  pthread_mutex_t goneMutex;
+  pthread_rwlock_t goneRwlock;
+  sem_t goneSema;
+  int i, value;
+
+  assert(pthread_mutexattr_init(&ma) == 0);
+  assert(pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED) == 0);
+  assert(pthread_mutexattr_settype(&ma, PTHREAD_MUTEX_ERRORCHECK) == 0);
+#ifdef USE_MUTEX_InPlace
+  assert(pthread_mutex_init(&mutex, &ma) == ENOTSUP);
+  assert(pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_PRIVATE) == 0);
+#endif
+  assert(pthread_mutex_init(&mutex, &ma) == 0);
+  assert(pthread_mutexattr_destroy(&ma) == 0);
+
+  assert(pthread_condattr_init(&ca) == 0);
+  assert(pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED) == 0);
+  assert(pthread_cond_init(&cv, &ca) == 0);
+  assert(pthread_condattr_destroy(&ca) == 0);
+
+  assert(pthread_rwlockattr_init(&ra) == 0);
+  assert(pthread_rwlockattr_setpshared(&ra, PTHREAD_PROCESS_SHARED) == 0);
+  assert(pthread_rwlock_init(&rwlock, &ra) == 0);
+  assert(pthread_rwlockattr_destroy(&ra) == 0);
+
+  assert(pthread_barrierattr_init(&ba) == 0);
+  assert(pthread_barrierattr_setpshared(&ba, PTHREAD_PROCESS_SHARED) == 0);
+  assert(pthread_barrier_init(&barrier, &ba, NUMTHREADS) == 0);
+  assert(pthread_barrierattr_destroy(&ba) == 0);
+
+  assert(sem_init(&sema, PTHREAD_PROCESS_SHARED, 0) == 0);
+  assert(pthread_spin_init(&spin, PTHREAD_PROCESS_SHARED) == 0);
+
+  /* Single threaded checks of the try and error paths.  */
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_mutex_lock(&mutex) == EDEADLK);
+  assert(pthread_mutex_trylock(&mutex) == EBUSY);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(pthread_mutex_unlock(&mutex) == EPERM);
+
+  assert(pthread_rwlock_rdlock(&rwlock) == 0);
+  assert(pthread_rwlock_tryrdlock(&rwlock) == 0);
+  assert(pthread_rwlock_trywrlock(&rwlock) == EBUSY);
+  assert(pthread_rwlock_unlock(&rwlock) == 0);
+  assert(pthread_rwlock_unlock(&rwlock) == 0);
+
+  assert(pthread_spin_trylock(&spin) == 0);
+  assert(pthread_spin_trylock(&spin) == EBUSY);
+  assert(pthread_spin_unlock(&spin) == 0);
+
+  assert(sem_trywait(&sema) == -1);
+  assert(errno == EAGAIN);
+
+  _ftime(&currSysTime);
+  abstime.tv_sec = currSysTime.time;
+  abstime.tv_nsec = NANOSEC_PER_MILLISEC * currSysTime.millitm;
+  abstime.tv_nsec += 100 * NANOSEC_PER_MILLISEC;
+  if (abstime.tv_nsec >= 1000000000)
+    {
+      abstime.tv_sec++;
+      abstime.tv_nsec -= 1000000000;
+    }
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_cond_timedwait(&cv, &mutex, &abstime) == ETIMEDOUT);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  /* Threaded checks.  */
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(pthread_create(&t[i], NULL, worker, NULL) == 0);
+
+  Sleep(100);
+  assert(pthread_mutex_lock(&mutex) == 0);
+  ready = 1;
+  assert(pthread_cond_broadcast(&cv) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(sem_wait(&sema) == 0);
+
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(pthread_join(t[i], NULL) == 0);
+
+  assert(sem_getvalue(&sema, &value) == 0);
+  assert(value == 0);
+
+  assert(mutexCount == NUMTHREADS * ITERATIONS);
+  assert(rwlockCount == NUMTHREADS * ITERATIONS);
+  assert(spinCount == NUMTHREADS * ITERATIONS);
+
+  /* Copies of the keys, which outlive the objects.  */
+  goneMutex = mutex;
+  goneRwlock = rwlock;
+  goneSema = sema;
+
+  assert(pthread_mutex_destroy(&mutex) == 0);
+  assert(pthread_cond_destroy(&cv) == 0);
+  assert(pthread_rwlock_destroy(&rwlock) == 0);
+  assert(pthread_barrier_destroy(&barrier) == 0);
+  assert(sem_destroy(&sema) == 0);
+  assert(pthread_spin_destroy(&spin) == 0);
+
+  /* No process has them open anymore.  */
+#ifndef USE_MUTEX_InPlace
+  assert(pthread_mutex_lock(&goneMutex) == EINVAL);
+#endif
+  assert(pthread_rwlock_rdlock(&goneRwlock) == EINVAL);
+  assert(sem_wait(&goneSema) == -1);
+  assert(errno == EINVAL);
+
+  return 0;
+}
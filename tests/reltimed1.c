@@ -0,0 +1,139 @@
+/* 
+ * reltimed1.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Test the waits with a relative timeout.
+ * Each of them must time out on a busy object after about the time
+ * given, and succeed at once on an available one.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *	pthread_cond_reltimedwait_np()
+ *	pthread_mutex_reltimedlock_np()
+ *	pthread_rwlock_reltimedrdlock_np()
+ *	pthread_rwlock_reltimedwrlock_np()
+ *	sem_reltimedwait_np()
+ */
+
+#include "test.h"
+
+#define TIMEOUT_MS	50
+
+static pthread_mutex_t mutex;
+static pthread_cond_t cv;
+static pthread_rwlock_t rwlock;
+static sem_t sem;
+static struct timespec rel = { 0, TIMEOUT_MS * 1000000L };
+static struct timespec start;
+
+static void
+startClock(void)
+{
+  assert(clock_gettime(CLOCK_MONOTONIC, &start) == 0);
+}
+
+/* The wait may end early by a timer tick.  */
+static void
+checkElapsed(void)
+{
+  struct timespec now;
+  long long ms;
+
+  assert(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+  ms = (now.tv_sec - start.tv_sec) * 1000LL + (now.tv_nsec - start.tv_nsec) / 1000000;
+  assert(ms >= TIMEOUT_MS - 20);
+  assert(ms < 5000);
+}
+
+void *
+locker(void * arg)
+{
+  startClock();
+  assert(pthread_mutex_reltimedlock_np(&mutex, &rel) == ETIMEDOUT);
+  checkElapsed();
+  startClock();
+  assert(pthread_rwlock_reltimedrdlock_np(&rwlock, &rel) == ETIMEDOUT);
+  checkElapsed();
+  startClock();
+  assert(pthread_rwlock_reltimedwrlock_np(&rwlock, &rel) == ETIMEDOUT);
+  checkElapsed();
+
+  return 0;
+}
+
+int
+main()
+{
+  pthread_t t;
+
+  assert(pthread_mutex_init(&mutex, NULL) == 0);
+  assert(pthread_cond_init(&cv, NULL) == 0);
+  assert(pthread_rwlock_init(&rwlock, NULL) == 0);
+  assert(sem_init(&sem, 0, 0) == 0);
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  startClock();
+  assert(pthread_cond_reltimedwait_np(&cv, &mutex, &rel) == ETIMEDOUT);
+  checkElapsed();
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  startClock();
+  assert(sem_reltimedwait_np(&sem, &rel) == -1);
+  assert(errno == ETIMEDOUT);
+  checkElapsed();
+  assert(sem_post(&sem) == 0);
+  assert(sem_reltimedwait_np(&sem, &rel) == 0);
+
+  assert(pthread_mutex_lock(&mutex) == 0);
+  assert(pthread_rwlock_wrlock(&rwlock) == 0);
+  assert(pthread_create(&t, NULL, locker, NULL) == 0);
+  assert(pthread_join(t, NULL) == 0);
+  assert(pthread_rwlock_unlock(&rwlock) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+
+  assert(pthread_mutex_reltimedlock_np(&mutex, &rel) == 0);
+  assert(pthread_mutex_unlock(&mutex) == 0);
+  assert(pthread_rwlock_reltimedrdlock_np(&rwlock, &rel) == 0);
+  assert(pthread_rwlock_unlock(&rwlock) == 0);
+  assert(pthread_rwlock_reltimedwrlock_np(&rwlock, &rel) == 0);
+  assert(pthread_rwlock_unlock(&rwlock) == 0);
+
+  assert(sem_destroy(&sem) == 0);
+  assert(pthread_rwlock_destroy(&rwlock) == 0);
+  assert(pthread_cond_destroy(&cv) == 0);
+  assert(pthread_mutex_destroy(&mutex) == 0);
+
+  return 0;
+}
@@ -0,0 +1,116 @@
+/* 
+ * rwlock10.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ *
+ * Destroy a rwlock right after a timed writer gave up on it while the
+ * readers it waited for were releasing it.  The last of them may still
+ * be inside pthread_rwlock_unlock when the lock is destroyed.
+ *
+ * Depends on API functions: 
+ *      pthread_rwlock_init()
+ *      pthread_rwlock_rdlock()
+ *      pthread_rwlock_timedwrlock()
+ *      pthread_rwlock_trywrlock()
+ *      pthread_rwlock_unlock()
+ *      pthread_rwlock_destroy()
+ */
+
+#include "test.h"
+#include <sys/timeb.h>
+
+#define READERS 4
+#define ROUNDS 200
+
+static pthread_rwlock_t rwlock1;
+static volatile LONG holding = 0;
+
+void * rdfunc(void * arg)
+{
+  int round = (int) (size_t) arg;
+
+  assert(pthread_rwlock_rdlock(&rwlock1) == 0);
+  InterlockedIncrement(&holding);
+  /* Release around the time the writer times out.  */
+  Sleep(round % 3);
+  assert(pthread_rwlock_unlock(&rwlock1) == 0);
+  return NULL;
+}
+
+int
+main()
+{
+  pthread_t t[READERS];
+  struct timespec abstime;
+  struct _timeb currSysTime;
+  const DWORD NANOSEC_PER_MILLISEC = 1000000;
+  int i, j, r;
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      assert(pthread_rwlock_init(&rwlock1, NULL) == 0);
+      holding = 0;
+      for (j = 0; j < READERS; j++)
+	assert(pthread_create(&t[j], NULL, rdfunc, (void *) (size_t) (i + j)) == 0);
+      while (holding < READERS)
+	Sleep(0);
+
+      _ftime(&currSysTime);
+      abstime.tv_sec = currSysTime.time;
+      abstime.tv_nsec = NANOSEC_PER_MILLISEC * (currSysTime.millitm + 1);
+      if (abstime.tv_nsec >= 1000000000)
+	{
+	  abstime.tv_sec++;
+	  abstime.tv_nsec -= 1000000000;
+	}
+      r = pthread_rwlock_timedwrlock(&rwlock1, &abstime);
+      assert(r == 0 || r == ETIMEDOUT);
+      if (r == 0)
+	assert(pthread_rwlock_unlock(&rwlock1) == 0);
+
+      while (pthread_rwlock_trywrlock(&rwlock1) != 0)
+	Sleep(0);
+      assert(pthread_rwlock_unlock(&rwlock1) == 0);
+      /* Implementations counting the threads inside a call may say
+	 EBUSY until the readers returned.  */
+      while ((r = pthread_rwlock_destroy(&rwlock1)) == EBUSY)
+	Sleep(0);
+      assert(r == 0);
+
+      for (j = 0; j < READERS; j++)
+	assert(pthread_join(t[j], NULL) == 0);
+    }
+
+  return 0;
+}
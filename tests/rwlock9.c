@@ -0,0 +1,162 @@
+/* 
+ * rwlock9.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ *
+ * Check that readers queued behind a writer get in when the writer
+ * times out, and that timed-out writers don't break the exclusion of
+ * readers and writers under contention.
+ *
+ * Depends on API functions: 
+ *      pthread_rwlock_init()
+ *      pthread_rwlock_rdlock()
+ *      pthread_rwlock_timedwrlock()
+ *      pthread_rwlock_wrlock()
+ *      pthread_rwlock_unlock()
+ *      pthread_rwlock_destroy()
+ */
+
+#include "test.h"
+#include <sys/timeb.h>
+
+#define THREADS 8
+#define ITERATIONS 2000
+
+static pthread_rwlock_t rwlock1;
+
+static struct timespec abstime = { 0, 0 };
+static volatile LONG readers = 0;
+static volatile LONG writers = 0;
+static volatile LONG timeouts = 0;
+
+static void
+settime(struct timespec *ts, int ms)
+{
+  struct _timeb currSysTime;
+  const DWORD NANOSEC_PER_MILLISEC = 1000000;
+
+  _ftime(&currSysTime);
+  ts->tv_sec = currSysTime.time + ms / 1000;
+  ts->tv_nsec = NANOSEC_PER_MILLISEC * (currSysTime.millitm + ms % 1000);
+  if (ts->tv_nsec >= 1000000000)
+    {
+      ts->tv_sec++;
+      ts->tv_nsec -= 1000000000;
+    }
+}
+
+void * wrfunc(void * arg)
+{
+  assert(pthread_rwlock_timedwrlock(&rwlock1, &abstime) == ETIMEDOUT);
+  return NULL;
+}
+
+void * rdfunc(void * arg)
+{
+  assert(pthread_rwlock_rdlock(&rwlock1) == 0);
+  InterlockedIncrement(&readers);
+  assert(pthread_rwlock_unlock(&rwlock1) == 0);
+  return NULL;
+}
+
+void * mixfunc(void * arg)
+{
+  struct timespec ts;
+  int i, r;
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      if (i % 4 != 0)
+	{
+	  assert(pthread_rwlock_rdlock(&rwlock1) == 0);
+	  InterlockedIncrement(&readers);
+	  assert(writers == 0);
+	  InterlockedDecrement(&readers);
+	}
+      else
+	{
+	  if (i % 8 == 0)
+	    {
+	      settime(&ts, 1);
+	      r = pthread_rwlock_timedwrlock(&rwlock1, &ts);
+	      assert(r == 0 || r == ETIMEDOUT);
+	      if (r != 0)
+		{
+		  InterlockedIncrement(&timeouts);
+		  continue;
+		}
+	    }
+	  else
+	    assert(pthread_rwlock_wrlock(&rwlock1) == 0);
+	  assert(InterlockedIncrement(&writers) == 1);
+	  assert(readers == 0);
+	  InterlockedDecrement(&writers);
+	}
+      assert(pthread_rwlock_unlock(&rwlock1) == 0);
+    }
+  return NULL;
+}
+
+int
+main()
+{
+  pthread_t wrt;
+  pthread_t rdt;
+  pthread_t t[THREADS];
+  int i;
+
+  assert(pthread_rwlock_init(&rwlock1, NULL) == 0);
+
+  assert(pthread_rwlock_rdlock(&rwlock1) == 0);
+  settime(&abstime, 1000);
+  assert(pthread_create(&wrt, NULL, wrfunc, NULL) == 0);
+  Sleep(200);
+  assert(pthread_create(&rdt, NULL, rdfunc, NULL) == 0);
+  assert(pthread_join(wrt, NULL) == 0);
+  /* The read lock is still held.  */
+  assert(pthread_join(rdt, NULL) == 0);
+  assert(readers == 1);
+  assert(pthread_rwlock_unlock(&rwlock1) == 0);
+
+  readers = 0;
+  for (i = 0; i < THREADS; i++)
+    assert(pthread_create(&t[i], NULL, mixfunc, NULL) == 0);
+  for (i = 0; i < THREADS; i++)
+    assert(pthread_join(t[i], NULL) == 0);
+  assert(readers == 0 && writers == 0);
+
+  assert(pthread_rwlock_destroy(&rwlock1) == 0);
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+/* 
+ * spin5.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Tests spinlock fairness and pthread_spin_timedlock_np.
+ * Several threads increment a counter under one spinlock; none may
+ * starve, so each must get the lock about as often as the others.
+ * A timed lock on a held spinlock must time out, on a free one it
+ * must succeed.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *	pthread_spin_init()
+ *	pthread_spin_lock()
+ *	pthread_spin_timedlock_np()
+ *	pthread_spin_unlock()
+ */
+
+#include "test.h"
+#include <sys/timeb.h>
+
+#define NUMTHREADS 8
+#define ITERATIONS 2000
+
+static pthread_spinlock_t lock;
+static int count = 0;
+static int turns[NUMTHREADS];
+static int last = -1;
+
+void * func(void * arg)
+{
+  int me = (int) (size_t) arg;
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      assert(pthread_spin_lock(&lock) == 0);
+      count++;
+      /* Count the times the lock changed hands to this thread.  */
+      if (last != me)
+	turns[me]++;
+      last = me;
+      assert(pthread_spin_unlock(&lock) == 0);
+    }
+
+  return 0;
+}
+
+int
+main()
+{
+  pthread_t t[NUMTHREADS];
+  struct timespec abstime = { 0, 0 };
+  struct _timeb currSysTime;
+  const DWORD NANOSEC_PER_MILLISEC = 1000000;
+  int i;
+
+  assert(pthread_spin_init(&lock, PTHREAD_PROCESS_PRIVATE) == 0);
+
+  _ftime(&currSysTime);
+  abstime.tv_sec = currSysTime.time;
+  abstime.tv_nsec = NANOSEC_PER_MILLISEC * currSysTime.millitm;
+  abstime.tv_nsec += 100 * NANOSEC_PER_MILLISEC;
+  if (abstime.tv_nsec >= 1000000000)
+    {
+      abstime.tv_sec++;
+      abstime.tv_nsec -= 1000000000;
+    }
+
+  assert(pthread_spin_timedlock_np(&lock, &abstime) == 0);
+  assert(pthread_spin_trylock(&lock) == EBUSY);
+  assert(pthread_spin_timedlock_np(&lock, &abstime) == ETIMEDOUT);
+  assert(pthread_spin_unlock(&lock) == 0);
+  assert(pthread_spin_unlock(&lock) == EPERM);
+
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(pthread_create(&t[i], NULL, func, (void *) (size_t) i) == 0);
+
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(pthread_join(t[i], NULL) == 0);
+
+  assert(count == NUMTHREADS * ITERATIONS);
+  for (i = 0; i < NUMTHREADS; i++)
+    assert(turns[i] > 0);
+
+  assert(pthread_spin_destroy(&lock) == 0);
+
+  return 0;
+}
@@ -0,0 +1,133 @@
+/* 
+ * spin6.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Tests a spinlock with more threads than processors.  Holders get
+ * preempted while others wait, which must not stall the test: the
+ * waiters have to give up the processor to let the holder run.
+ *
+ * Then, with USE_SPINLOCK_Hybrid, a waiter on an internal lock held
+ * for long has to park, and has to get the lock right after it is
+ * released, not at the next timer tick.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *	pthread_spin_lock()
+ *	pthread_spin_unlock()
+ *	pthread_num_processors_np()
+ */
+
+#include "test.h"
+#include "../src/spinlock.h"
+
+#define MAXTHREADS 64
+#define ITERATIONS 20000
+#define PARKROUNDS 20
+
+static pthread_spinlock_t lock = PTHREAD_SPINLOCK_INITIALIZER;
+static int count = 0;
+
+static spin_t ilock = SPIN_LITE_INITIALIZER(NULL);
+static LARGE_INTEGER released, acquired;
+
+void * parker(void * arg)
+{
+  _spin_lite_lock(&ilock);
+  QueryPerformanceCounter(&acquired);
+  _spin_lite_unlock(&ilock);
+  return 0;
+}
+
+void * func(void * arg)
+{
+  int i, j;
+  volatile int work = 0;
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      assert(pthread_spin_lock(&lock) == 0);
+      count++;
+      for (j = 0; j < 10; j++)
+	work++;
+      assert(pthread_spin_unlock(&lock) == 0);
+    }
+
+  return 0;
+}
+
+int
+main()
+{
+  pthread_t t[MAXTHREADS];
+  int i, n;
+
+  n = 3 * pthread_num_processors_np();
+  if (n > MAXTHREADS)
+    n = MAXTHREADS;
+
+  for (i = 0; i < n; i++)
+    assert(pthread_create(&t[i], NULL, func, NULL) == 0);
+
+  for (i = 0; i < n; i++)
+    assert(pthread_join(t[i], NULL) == 0);
+
+  assert(count == n * ITERATIONS);
+
+  assert(pthread_spin_destroy(&lock) == 0);
+
+#ifdef USE_SPINLOCK_Hybrid
+  {
+    LARGE_INTEGER freq;
+    double total = 0;
+
+    QueryPerformanceFrequency(&freq);
+    for (i = 0; i < PARKROUNDS; i++)
+      {
+	_spin_lite_lock(&ilock);
+	assert(pthread_create(&t[0], NULL, parker, NULL) == 0);
+	Sleep(50);
+	assert(ilock.l == SPIN_LITE_PARKED);
+	QueryPerformanceCounter(&released);
+	_spin_lite_unlock(&ilock);
+	assert(pthread_join(t[0], NULL) == 0);
+	total += (double) (acquired.QuadPart - released.QuadPart) / freq.QuadPart;
+      }
+    /* Waking up at the next timer tick takes about 8 ms on average.  */
+    assert(total / PARKROUNDS < 0.002);
+  }
+#endif
+
+  return 0;
+}
@@ -0,0 +1,141 @@
+/* 
+ * spin7.c
+ *
+ *
+ * --------------------------------------------------------------------------
+ *
+ *      Pthreads-win32 - POSIX Threads Library for Win32
+ *      Copyright(C) 1998 John E. Bossom
+ *      Copyright(C) 1999,2005 Pthreads-win32 contributors
+ * 
+ *      Contact Email: rpj@callisto.canberra.edu.au
+ * 
+ *      The current list of contributors is contained
+ *      in the file CONTRIBUTORS included with the source
+ *      code distribution. The list can also be seen at the
+ *      following World Wide Web location:
+ *      http://sources.redhat.com/pthreads-win32/contributors.html
+ * 
+ *      This library is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU Lesser General Public
+ *      License as published by the Free Software Foundation; either
+ *      version 2 of the License, or (at your option) any later version.
+ * 
+ *      This library is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *      Lesser General Public License for more details.
+ * 
+ *      You should have received a copy of the GNU Lesser General Public
+ *      License along with this library in the file COPYING.LIB;
+ *      if not, write to the Free Software Foundation, Inc.,
+ *      59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ *
+ * --------------------------------------------------------------------------
+ *
+ * Tests the spinlock contention statistics.
+ * A thread has to spin on a spinlock held by main, which has to
+ * show up in the statistics of that spinlock.  The statistics of
+ * the library's internal locks must be listed as well.
+ *
+ * Depends on API functions: 
+ *      pthread_create()
+ *      pthread_join()
+ *      pthread_spin_setstats_np()
+ *      pthread_spin_getstats_np()
+ *      pthread_spin_enumstats_np()
+ *	pthread_spin_init()
+ *	pthread_spin_lock()
+ *	pthread_spin_unlock()
+ *	pthread_rwlock_rdlock()
+ */
+
+#include "test.h"
+#include <string.h>
+
+static pthread_spinlock_t lock;
+static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static int found = 0;
+static int foundInternal = 0;
+
+void * locker(void * arg)
+{
+  assert(pthread_spin_lock(&lock) == 0);
+  assert(pthread_spin_unlock(&lock) == 0);
+
+  return 0;
+}
+
+static int
+count(pthread_spinlock_t *l, const char *name, const pthread_spin_stats_np *s, void *arg)
+{
+  if (l == &lock)
+    {
+      assert(name == NULL);
+      assert(s->acquisitions == 12);
+      found++;
+    }
+  else if (l == NULL && name != NULL && strcmp(name, "rwl_global") == 0)
+    {
+      assert(s->acquisitions > 0);
+      foundInternal++;
+    }
+  return 0;
+}
+
+int
+main()
+{
+  pthread_spin_stats_np s;
+  pthread_t t;
+  int i;
+
+  assert(pthread_spin_setstats_np(1) == 0);
+  assert(pthread_spin_init(&lock, PTHREAD_PROCESS_PRIVATE) == 0);
+
+  for (i = 0; i < 10; i++)
+    {
+      assert(pthread_spin_lock(&lock) == 0);
+      assert(pthread_spin_unlock(&lock) == 0);
+    }
+  assert(pthread_spin_getstats_np(&lock, &s) == 0);
+  assert(s.acquisitions == 10);
+  assert(s.contended == 0);
+  assert(s.spins == 0);
+
+  assert(pthread_spin_lock(&lock) == 0);
+  assert(pthread_create(&t, NULL, locker, NULL) == 0);
+  Sleep(200);
+  assert(pthread_spin_unlock(&lock) == 0);
+  assert(pthread_join(t, NULL) == 0);
+
+  assert(pthread_spin_getstats_np(&lock, &s) == 0);
+  assert(s.acquisitions == 12);
+  assert(s.contended == 1);
+  assert(s.spins_max > 0);
+  assert(s.spins >= s.spins_max);
+
+  assert(pthread_spin_setstats_np(0) == 0);
+  assert(pthread_spin_lock(&lock) == 0);
+  assert(pthread_spin_unlock(&lock) == 0);
+  assert(pthread_spin_getstats_np(&lock, &s) == 0);
+  assert(s.acquisitions == 12);
+
+  /* rwlocks take an internal lock.  */
+  assert(pthread_spin_setstats_np(1) == 0);
+  assert(pthread_rwlock_rdlock(&rwlock) == 0);
+  assert(pthread_rwlock_unlock(&rwlock) == 0);
+  assert(pthread_spin_setstats_np(0) == 0);
+
+  assert(pthread_spin_enumstats_np(count, NULL) == 0);
+  assert(found == 1);
+  assert(foundInternal == 1);
+
+  assert(pthread_spin_destroy(&lock) == 0);
+
+  found = 0;
+  assert(pthread_spin_enumstats_np(count, NULL) == 0);
+  assert(found == 0);
+
+  return 0;
+}